@@ -223,6 +223,21 @@ LOCAL_VENDOR_MODULE := true
 
 include $(BUILD_EXECUTABLE)
 
+#
+# canlatency
+#
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := canlatency.c
+LOCAL_MODULE := canlatency
+LOCAL_MODULE_TAGS := optional
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/include/
+LOCAL_CFLAGS := $(PRIVATE_LOCAL_CFLAGS)
+LOCAL_VENDOR_MODULE := true
+
+include $(BUILD_EXECUTABLE)
+
 #
 # cangw
 #
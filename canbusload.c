@@ -48,9 +48,12 @@
 #include <string.h>
 #include <signal.h>
 #include <ctype.h>
+#include <errno.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <time.h>
 
+#include <sys/epoll.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -64,20 +67,54 @@
 #include "terminal.h"
 #include "canframelen.h"
 
-#define MAXSOCK 16    /* max. number of CAN interfaces given on the cmdline */
+#define BATCHSZ 64 /* max. number of CAN frames per recvmmsg() syscall */
+#define MAXEVENTS 16 /* max. number of epoll events per epoll_wait() */
 
 #define PERCENTRES 5 /* resolution in percent for bargraph */
 #define NUMBAR (100/PERCENTRES) /* number of bargraph elements */
 
+#define IDTABSZ 1024 /* initial size of the CAN ID hash table (power of 2) */
+
+#define MAXWINDOW 1000 /* max. sampling window in ms */
+#define LOADHISTSZ 2001 /* bus load histogram in 0.1% steps up to 200% */
+
 extern int optind, opterr, optopt;
 
+/* bus load of one CAN ID - unused hash table entries have no frames */
+struct idstat {
+	canid_t id;
+	unsigned int frames;
+	unsigned int bits_total;
+	unsigned int bits_payload;
+};
+
+struct counters {
+	unsigned long long frames;
+	unsigned long long bits_total;
+	unsigned long long bits_payload;
+};
+
 static struct {
 	char devname[IFNAMSIZ+1];
+	int s;
 	unsigned int bitrate;
-	unsigned int recv_frames;
-	unsigned int recv_bits_total;
-	unsigned int recv_bits_payload;
-} stat[MAXSOCK+1];
+	unsigned int dbitrate;
+	unsigned int seq; /* odd while the receive thread updates 'recv' */
+	struct counters recv; /* only written by the receive thread */
+	struct counters last; /* 'recv' at the last output */
+	pthread_mutex_t lock; /* CAN ID table and sampling windows */
+	struct idstat *ids; /* open addressing hash table */
+	unsigned int idsize;
+	unsigned int idcount;
+	unsigned long long win_start; /* ns (CLOCK_REALTIME) */
+	unsigned int win_frames;
+	unsigned int win_bits;
+	unsigned int win_count; /* sampling windows in this output interval */
+	unsigned int win_min; /* bus load in 0.1% */
+	unsigned int win_max;
+	unsigned long long win_sum;
+	unsigned int *win_hist;
+} *stat;
 
 static int  max_devname_len; /* to prevent frazzled device name output */ 
 static int  max_bitrate_len;
@@ -86,6 +123,11 @@ static unsigned char redraw;
 static unsigned char timestamp;
 static unsigned char color;
 static unsigned char bargraph;
+static unsigned int topn;
+static unsigned int window; /* ms */
+static FILE *wfile;
+static struct idstat **top;
+static unsigned char threads; /* one receive thread per interface */
 static enum cfl_mode mode = CFL_WORSTCASE;
 static char *prg;
 
@@ -101,14 +143,30 @@ void print_usage(char *prg)
 	fprintf(stderr, "         -r  (redraw the terminal - similar to top)\n");
 	fprintf(stderr, "         -i  (ignore bitstuffing in bandwidth calculation)\n");
 	fprintf(stderr, "         -e  (exact calculation of stuffed bits)\n");
+	fprintf(stderr, "         -n <num>  (show the <num> CAN IDs with the most used bits)\n");
+	fprintf(stderr, "         -w <ms>   (show min/avg/max/p99 bus load of sampling windows with\n");
+	fprintf(stderr, "                    <ms> length - 1..%d)\n", MAXWINDOW);
+	fprintf(stderr, "         -W <file> (write the bus load of each sampling window to <file>)\n");
+	fprintf(stderr, "         -T  (use one receive thread per CAN interface)\n");
 	fprintf(stderr, "\n");
-	fprintf(stderr, "Up to %d CAN interfaces with mandatory bitrate can be specified on the \n", MAXSOCK);
-	fprintf(stderr, "commandline in the form: <ifname>@<bitrate>\n\n");
+	fprintf(stderr, "The CAN interfaces with mandatory bitrate are specified on the commandline\n");
+	fprintf(stderr, "in the form: <ifname>@<bitrate>[,<dbitrate>]\n\n");
 	fprintf(stderr, "The bitrate is mandatory as it is needed to know the CAN bus bitrate to\n");
 	fprintf(stderr, "calculate the bus load percentage based on the received CAN frames.\n");
+	fprintf(stderr, "The optional data bitrate is used for the data phase of CAN FD frames with\n");
+	fprintf(stderr, "bitrate switch (BRS). The bits of the data phase are shown as the equivalent\n");
+	fprintf(stderr, "number of bits with the (nominal) bitrate.\n");
 	fprintf(stderr, "Due to the bitstuffing estimation the calculated busload may exceed 100%%.\n");
 	fprintf(stderr, "For each given interface the data is presented in one line which contains:\n\n");
 	fprintf(stderr, "(interface) (received CAN frames) (used bits total) (used bits for payload)\n");
+	fprintf(stderr, "\nWith -w the bus load is additionally calculated for sampling windows based\n");
+	fprintf(stderr, "on the kernel timestamps of the CAN frames. The interface line is extended\n");
+	fprintf(stderr, "by the (min) (avg) (max) (99th percentile) bus load of the sampling windows\n");
+	fprintf(stderr, "that ended in the last second. With -W each sampling window is written as\n");
+	fprintf(stderr, "(window start),(interface),(CAN frames),(used bits total),(bus load)\n");
+	fprintf(stderr, "\nWith -n the CAN IDs of each interface are listed below the interface line:\n\n");
+	fprintf(stderr, "(CAN ID) (received CAN frames) (used bits total) (used bits for payload)\n");
+	fprintf(stderr, "(average period)\n");
 	fprintf(stderr, "\nExamples:\n");
 	fprintf(stderr, "\nuser$> canbusload can0@100000 can1@500000 can2@500000 can3@500000 -r -t -b -c\n\n");
 	fprintf(stderr, "%s 2014-02-01 21:13:16 (worst case bitstuffing)\n", prg);
@@ -124,8 +182,215 @@ void sigterm(int signo)
 	exit(0);
 }
 
-void printstats(int signo)
+static struct idstat *idslot(int i, canid_t id)
+{
+	unsigned int mask = stat[i].idsize - 1;
+	unsigned int h = id * 0x9E3779B1U;
+	struct idstat *e;
+
+	for (h = (h ^ h >> 16) & mask; ; h = (h + 1) & mask) {
+		e = &stat[i].ids[h];
+		if (!e->frames || e->id == id)
+			return e;
+	}
+}
+
+static void idtab_grow(int i)
+{
+	struct idstat *old = stat[i].ids;
+	unsigned int oldsize = stat[i].idsize;
+	unsigned int j;
+
+	stat[i].idsize = oldsize ? oldsize * 2 : IDTABSZ;
+	stat[i].ids = calloc(stat[i].idsize, sizeof(*stat[i].ids));
+	if (!stat[i].ids) {
+		perror("calloc");
+		exit(1);
+	}
+
+	for (j = 0; j < oldsize; j++) {
+		if (old[j].frames)
+			*idslot(i, old[j].id) = old[j];
+	}
+	free(old);
+}
+
+static void count_id(int i, canid_t id, unsigned int bits_total,
+		     unsigned int bits_payload)
+{
+	struct idstat *e;
+
+	/* keep the table half empty for short probe sequences */
+	if (stat[i].idcount >= stat[i].idsize / 2)
+		idtab_grow(i);
+
+	e = idslot(i, id);
+	if (!e->frames) {
+		e->id = id;
+		stat[i].idcount++;
+	}
+	e->frames++;
+	e->bits_total += bits_total;
+	e->bits_payload += bits_payload;
+}
+
+static void print_top(int i)
+{
+	struct idstat *e;
+	unsigned int j, k, n = 0;
+	char idstr[9];
+
+	/* insertion into the sorted list of the top CAN IDs */
+	for (j = 0; j < stat[i].idsize; j++) {
+		e = &stat[i].ids[j];
+		if (!e->frames)
+			continue;
+
+		if (n == topn && e->bits_total <= top[n-1]->bits_total)
+			continue;
+
+		k = (n < topn) ? n++ : n - 1;
+		for (; k > 0 && top[k-1]->bits_total < e->bits_total; k--)
+			top[k] = top[k-1];
+		top[k] = e;
+	}
+
+	for (j = 0; j < n; j++) {
+		e = top[j];
+
+		if (e->id & CAN_EFF_FLAG)
+			sprintf(idstr, "%08X", e->id & CAN_EFF_MASK);
+		else
+			sprintf(idstr, "%03X", e->id & CAN_SFF_MASK);
+
+		printf("\n %*s %5d %7d %6d %3d%% %7.2fms",
+		       max_devname_len + 1 + max_bitrate_len, idstr,
+		       e->frames,
+		       e->bits_total,
+		       e->bits_payload,
+		       e->bits_total * 100 / stat[i].bitrate,
+		       1000.0 / e->frames);
+	}
+
+	/* remove the CAN IDs of the last output */
+	if (redraw) {
+		for (; j < topn; j++)
+			printf("\n%s", CLR_LINE);
+	}
+
+	memset(stat[i].ids, 0, stat[i].idsize * sizeof(*stat[i].ids));
+	stat[i].idcount = 0;
+}
+
+static void close_window(int i)
+{
+	unsigned int load;
+
+	/* bus load in 0.1% */
+	load = (unsigned long long)stat[i].win_bits * 1000000 /
+		((unsigned long long)stat[i].bitrate * window);
+
+	if (!stat[i].win_count || load < stat[i].win_min)
+		stat[i].win_min = load;
+	if (load > stat[i].win_max)
+		stat[i].win_max = load;
+	stat[i].win_sum += load;
+	stat[i].win_count++;
+	stat[i].win_hist[(load < LOADHISTSZ) ? load : LOADHISTSZ - 1]++;
+
+	if (wfile)
+		fprintf(wfile, "%llu.%03llu,%s,%u,%u,%u.%u\n",
+			stat[i].win_start / 1000000000,
+			stat[i].win_start / 1000000 % 1000,
+			stat[i].devname, stat[i].win_frames, stat[i].win_bits,
+			load / 10, load % 10);
+
+	stat[i].win_start += window * 1000000ULL;
+	stat[i].win_frames = 0;
+	stat[i].win_bits = 0;
+}
+
+/* close the sampling windows that end up to 'ns' */
+static void update_windows(int i, unsigned long long ns)
 {
+	while (stat[i].win_start + window * 1000000ULL <= ns)
+		close_window(i);
+}
+
+static void print_windows(int i)
+{
+	unsigned int j, sum = 0, p99;
+
+	if (!stat[i].win_count)
+		return;
+
+	/* nearest rank */
+	for (j = 0; j < LOADHISTSZ - 1; j++) {
+		sum += stat[i].win_hist[j];
+		if (sum * 100 >= stat[i].win_count * 99)
+			break;
+	}
+	/* the last histogram entry collects all higher values */
+	p99 = (j < LOADHISTSZ - 1) ? j : stat[i].win_max;
+
+	printf(" min %3u.%u%% avg %3u.%u%% max %3u.%u%% p99 %3u.%u%%",
+	       stat[i].win_min / 10, stat[i].win_min % 10,
+	       (unsigned int)(stat[i].win_sum / stat[i].win_count) / 10,
+	       (unsigned int)(stat[i].win_sum / stat[i].win_count) % 10,
+	       stat[i].win_max / 10, stat[i].win_max % 10,
+	       p99 / 10, p99 % 10);
+
+	stat[i].win_count = 0;
+	stat[i].win_max = 0;
+	stat[i].win_sum = 0;
+	memset(stat[i].win_hist, 0, LOADHISTSZ * sizeof(*stat[i].win_hist));
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* add the received frames - called by the receive thread of the interface */
+static void stats_add(int i, struct counters *add)
+{
+	unsigned int seq = stat[i].seq;
+
+	__atomic_store_n(&stat[i].seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	__atomic_store_n(&stat[i].recv.frames,
+			 stat[i].recv.frames + add->frames, __ATOMIC_RELAXED);
+	__atomic_store_n(&stat[i].recv.bits_total,
+			 stat[i].recv.bits_total + add->bits_total, __ATOMIC_RELAXED);
+	__atomic_store_n(&stat[i].recv.bits_payload,
+			 stat[i].recv.bits_payload + add->bits_payload, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&stat[i].seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* consistent copy of the counters - retried while they are updated */
+static void stats_snapshot(int i, struct counters *c)
+{
+	unsigned int seq;
+
+	do {
+		seq = __atomic_load_n(&stat[i].seq, __ATOMIC_ACQUIRE);
+		c->frames = __atomic_load_n(&stat[i].recv.frames, __ATOMIC_RELAXED);
+		c->bits_total = __atomic_load_n(&stat[i].recv.bits_total, __ATOMIC_RELAXED);
+		c->bits_payload = __atomic_load_n(&stat[i].recv.bits_payload, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != __atomic_load_n(&stat[i].seq, __ATOMIC_RELAXED));
+}
+
+void printstats(void)
+{
+	unsigned long long realtime = now_ns();
+	struct counters c;
+	unsigned int frames, bits_total, bits_payload;
 	int i, j, percent;
 
 	if (redraw)
@@ -183,17 +448,23 @@ void printstats(int signo)
 				printf("%s", FGBLUE);
 		}
 
+		stats_snapshot(i, &c);
+		frames = c.frames - stat[i].last.frames;
+		bits_total = c.bits_total - stat[i].last.bits_total;
+		bits_payload = c.bits_payload - stat[i].last.bits_payload;
+		stat[i].last = c;
+
 		if (stat[i].bitrate)
-			percent = (stat[i].recv_bits_total*100)/stat[i].bitrate;
+			percent = (bits_total*100)/stat[i].bitrate;
 		else
 			percent = 0;
 
 		printf(" %*s@%-*d %5d %7d %6d %3d%%",
 		       max_devname_len, stat[i].devname,
 		       max_bitrate_len, stat[i].bitrate,
-		       stat[i].recv_frames,
-		       stat[i].recv_bits_total,
-		       stat[i].recv_bits_payload,
+		       frames,
+		       bits_total,
+		       bits_payload,
 		       percent);
 
 		if (bargraph) {
@@ -212,45 +483,179 @@ void printstats(int signo)
 	    
 			printf("|");
 		}
+
+		pthread_mutex_lock(&stat[i].lock);
+
+		if (window) {
+			update_windows(i, realtime);
+			print_windows(i);
+		}
+
+		if (topn)
+			print_top(i);
+
+		pthread_mutex_unlock(&stat[i].lock);
 	
 		if (color)
 			printf("%s", ATTRESET);
 
 		printf("\n");
-
-		stat[i].recv_frames = 0;
-		stat[i].recv_bits_total = 0;
-		stat[i].recv_bits_payload = 0;
 	}
 
 	printf("\n");
 	fflush(stdout);
 
-	alarm(1);
+	if (wfile)
+		fflush(wfile);
 }
 
-int main(int argc, char **argv)
+/* account the frames of one recvmmsg() call */
+static void rx_frames(int i, struct mmsghdr *mmsg, int num)
 {
-	fd_set rdfs;
-	int s[MAXSOCK];
+	struct counters add = { 0 };
+	struct canfd_frame *frame;
+	struct cmsghdr *cmsg;
+	struct timespec ts;
+	unsigned int data_bits, bits_total, bits_payload;
+	unsigned long long frame_ns;
+	int j;
+
+	if (topn || window)
+		pthread_mutex_lock(&stat[i].lock);
+
+	for (j = 0; j < num; j++) {
+		frame = mmsg[j].msg_hdr.msg_iov->iov_base;
+
+		if (mmsg[j].msg_len != CAN_MTU && mmsg[j].msg_len != CANFD_MTU) {
+			fprintf(stderr, "read: incomplete CAN frame\n");
+			exit(1);
+		}
+
+		bits_total = can_frame_length_phases(frame, mode, mmsg[j].msg_len,
+						     &data_bits);
 
+		/* data phase bits as bits with the nominal bitrate */
+		if (data_bits) {
+			bits_total += (unsigned long long)data_bits *
+				stat[i].bitrate / stat[i].dbitrate;
+			bits_payload = (unsigned long long)frame->len * 8 *
+				stat[i].bitrate / stat[i].dbitrate;
+		} else
+			bits_payload = frame->len*8;
+
+		add.frames++;
+		add.bits_total += bits_total;
+		add.bits_payload += bits_payload;
+
+		if (topn)
+			count_id(i, frame->can_id & (CAN_EFF_FLAG | CAN_EFF_MASK),
+				 bits_total, bits_payload);
+
+		if (!window)
+			continue;
+
+		frame_ns = 0;
+		for (cmsg = CMSG_FIRSTHDR(&mmsg[j].msg_hdr);
+		     cmsg && (cmsg->cmsg_level == SOL_SOCKET);
+		     cmsg = CMSG_NXTHDR(&mmsg[j].msg_hdr, cmsg)) {
+			if (cmsg->cmsg_type == SO_TIMESTAMPNS) {
+				memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+				frame_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+			}
+		}
+		if (!frame_ns)
+			frame_ns = now_ns();
+
+		/*
+		 * frames that are read after their sampling window
+		 * has been closed are counted in the current window
+		 */
+		update_windows(i, frame_ns);
+		stat[i].win_frames++;
+		stat[i].win_bits += bits_total;
+	}
+
+	if (topn || window)
+		pthread_mutex_unlock(&stat[i].lock);
+
+	stats_add(i, &add);
+}
+
+/* receive from the CAN interfaces in the epoll set 'arg' */
+static void *rx_thread(void *arg)
+{
+	int efd = (long)arg;
+	struct epoll_event events[MAXEVENTS];
+	struct mmsghdr mmsg[BATCHSZ];
+	struct iovec iov[BATCHSZ];
+	struct canfd_frame frame[BATCHSZ];
+	char ctrlmsg[BATCHSZ][CMSG_SPACE(sizeof(struct timespec))];
+	int num_events, num, i, j;
+
+	memset(mmsg, 0, sizeof(mmsg));
+	for (j = 0; j < BATCHSZ; j++) {
+		iov[j].iov_base = &frame[j];
+		mmsg[j].msg_hdr.msg_iov = &iov[j];
+		mmsg[j].msg_hdr.msg_iovlen = 1;
+		mmsg[j].msg_hdr.msg_control = &ctrlmsg[j];
+	}
+
+	while (1) {
+		num_events = epoll_wait(efd, events, MAXEVENTS, -1);
+		if (num_events < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			exit(1);
+		}
+
+		for (i = 0; i < num_events; i++) {
+			/* these settings may be modified by recvmmsg() */
+			for (j = 0; j < BATCHSZ; j++) {
+				iov[j].iov_len = sizeof(frame[j]);
+				mmsg[j].msg_hdr.msg_controllen = sizeof(ctrlmsg[j]);
+				mmsg[j].msg_hdr.msg_flags = 0;
+			}
+
+			num = recvmmsg(stat[events[i].data.u32].s, mmsg, BATCHSZ,
+				       MSG_DONTWAIT, NULL);
+			if (num < 0) {
+				if (errno == EAGAIN || errno == EINTR)
+					continue;
+				perror("recvmmsg");
+				exit(1);
+			}
+
+			rx_frames(events[i].data.u32, mmsg, num);
+		}
+	}
+
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
 	int opt;
 	char *ptr, *nptr;
 	struct sockaddr_can addr;
-	struct can_frame frame;
+	const int canfd_on = 1;
+	const int timestamp_on = 1;
+	struct epoll_event event = { .events = EPOLLIN };
+	struct timespec deadline;
+	pthread_t thread;
+	unsigned long long now;
+	char *wfilename = NULL;
 	int nbytes, i;
+	int efd = -1;
 	struct ifreq ifr;
-	sigset_t sigmask, savesigmask;
 
 	signal(SIGTERM, sigterm);
 	signal(SIGHUP, sigterm);
 	signal(SIGINT, sigterm);
 
-	signal(SIGALRM, printstats);
-
 	prg = basename(argv[0]);
 
-	while ((opt = getopt(argc, argv, "rtbcieh?")) != -1) {
+	while ((opt = getopt(argc, argv, "rtbcien:w:W:Th?")) != -1) {
 		switch (opt) {
 		case 'r':
 			redraw = 1;
@@ -276,6 +681,26 @@ int main(int argc, char **argv)
 			mode = CFL_EXACT;
 			break;
 
+		case 'n':
+			topn = strtoul(optarg, NULL, 10);
+			break;
+
+		case 'w':
+			window = strtoul(optarg, NULL, 10);
+			if (!window || window > MAXWINDOW) {
+				print_usage(prg);
+				exit(1);
+			}
+			break;
+
+		case 'W':
+			wfilename = optarg;
+			break;
+
+		case 'T':
+			threads = 1;
+			break;
+
 		default:
 			print_usage(prg);
 			exit(1);
@@ -287,20 +712,34 @@ int main(int argc, char **argv)
 		print_usage(prg);
 		exit(0);
 	}
+
+	if (wfilename && !window) {
+		fprintf(stderr, "The sampling windows (-W) need the window length (-w)!\n");
+		return 1;
+	}
 	
 	currmax = argc - optind; /* find real number of CAN devices */
 
-	if (currmax > MAXSOCK) {
-		printf("More than %d CAN devices given on commandline!\n", MAXSOCK);
+	stat = calloc(currmax, sizeof(*stat));
+	if (!stat) {
+		perror("calloc");
 		return 1;
 	}
 
+	if (topn) {
+		top = malloc(topn * sizeof(*top));
+		if (!top) {
+			perror("malloc");
+			return 1;
+		}
+	}
+
 	for (i=0; i < currmax; i++) {
 
 		ptr = argv[optind+i];
 
 		nbytes = strlen(ptr);
-		if (nbytes >= (int)(IFNAMSIZ+sizeof("@1000000")+1)) {
+		if (nbytes >= (int)(IFNAMSIZ+sizeof("@1000000,10000000")+1)) {
 			printf("name of CAN device '%s' is too long!\n", ptr);
 			return 1;
 		}
@@ -309,8 +748,8 @@ int main(int argc, char **argv)
 		printf("open %d '%s'.\n", i, ptr);
 #endif
 
-		s[i] = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-		if (s[i] < 0) {
+		stat[i].s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+		if (stat[i].s < 0) {
 			perror("socket");
 			return 1;
 		}
@@ -343,16 +782,27 @@ int main(int argc, char **argv)
 			return 1;
 		}
 
-		nbytes = strlen(nptr+1);
+		nbytes = strcspn(nptr+1, ",");
 		if (nbytes > max_bitrate_len)
 			max_bitrate_len = nbytes; /* for nice printing */
 
+		/* optional CAN FD data bitrate behind the ',' */
+		nptr += nbytes + 1;
+		if (*nptr == ',') {
+			stat[i].dbitrate = atoi(nptr+1);
+			if (!stat[i].dbitrate) {
+				printf("invalid data bitrate for CAN device '%s'!\n", ptr);
+				return 1;
+			}
+		} else
+			stat[i].dbitrate = stat[i].bitrate;
+
 
 #ifdef DEBUG
 		printf("using interface name '%s'.\n", ifr.ifr_name);
 #endif
 
-		if (ioctl(s[i], SIOCGIFINDEX, &ifr) < 0) {
+		if (ioctl(stat[i].s, SIOCGIFINDEX, &ifr) < 0) {
 			perror("SIOCGIFINDEX");
 			exit(1);
 		}
@@ -360,57 +810,85 @@ int main(int argc, char **argv)
 		addr.can_family = AF_CAN;
 		addr.can_ifindex = ifr.ifr_ifindex;
 
-		if (bind(s[i], (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		/* try to switch the socket into CAN FD mode */
+		setsockopt(stat[i].s, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &canfd_on, sizeof(canfd_on));
+
+		if (window) {
+			if (setsockopt(stat[i].s, SOL_SOCKET, SO_TIMESTAMPNS,
+				       &timestamp_on, sizeof(timestamp_on)) < 0) {
+				perror("setsockopt SO_TIMESTAMPNS");
+				return 1;
+			}
+
+			stat[i].win_hist = calloc(LOADHISTSZ, sizeof(*stat[i].win_hist));
+			if (!stat[i].win_hist) {
+				perror("calloc");
+				return 1;
+			}
+		}
+
+		if (bind(stat[i].s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
 			perror("bind");
 			return 1;
 		}
-	}
-
-	alarm(1);
 
-	if (redraw)
-		printf("%s", CLR_SCREEN);
+		pthread_mutex_init(&stat[i].lock, NULL);
+	}
 
-	while (1) {
+	if (wfilename) {
+		wfile = fopen(wfilename, "w");
+		if (!wfile) {
+			perror("fopen");
+			return 1;
+		}
+		fprintf(wfile, "time,interface,frames,bits,load\n");
+	}
 
-		FD_ZERO(&rdfs);
+	/* the sampling windows start at multiples of the window length */
+	if (window) {
+		now = now_ns();
 		for (i=0; i<currmax; i++)
-			FD_SET(s[i], &rdfs);
+			stat[i].win_start = now - now % (window * 1000000ULL);
+	}
 
-		savesigmask = sigmask;
+	/* one epoll set for all interfaces or one per interface and thread */
+	for (i=0; i<currmax; i++) {
 
-		if (pselect(s[currmax-1]+1, &rdfs, NULL, NULL, NULL, &sigmask) < 0) {
-			//perror("pselect");
-			sigmask = savesigmask;
-			continue;
+		if (efd < 0 || threads) {
+			efd = epoll_create1(0);
+			if (efd < 0) {
+				perror("epoll_create1");
+				return 1;
+			}
 		}
 
-		for (i=0; i<currmax; i++) {  /* check all CAN RAW sockets */
+		event.data.u32 = i;
+		if (epoll_ctl(efd, EPOLL_CTL_ADD, stat[i].s, &event)) {
+			perror("epoll_ctl");
+			return 1;
+		}
 
-			if (FD_ISSET(s[i], &rdfs)) {
+		if (i == currmax - 1 || threads) {
+			if (pthread_create(&thread, NULL, rx_thread, (void *)(long)efd)) {
+				perror("pthread_create");
+				return 1;
+			}
+		}
+	}
 
-				nbytes = read(s[i], &frame, sizeof(frame));
+	if (redraw)
+		printf("%s", CLR_SCREEN);
 
-				if (nbytes < 0) {
-					perror("read");
-					return 1;
-				}
+	/* output at absolute deadlines - no drift by the output time */
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
 
-				if (nbytes < (int)sizeof(struct can_frame)) {
-					fprintf(stderr, "read: incomplete CAN frame\n");
-					return 1;
-				}
+	while (1) {
+		deadline.tv_sec++;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL))
+			;
 
-				stat[i].recv_frames++;
-				stat[i].recv_bits_payload += frame.can_dlc*8;
-				stat[i].recv_bits_total += can_frame_length((struct canfd_frame*)&frame,
-									    mode, sizeof(frame));
-			}
-		}
+		printstats();
 	}
 
-	for (i=0; i<currmax; i++)
-		close(s[i]);
-
 	return 0;
 }
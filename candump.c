@@ -44,24 +44,36 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <ctype.h>
 #include <libgen.h>
+#include <limits.h>
 #include <time.h>
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <net/if.h>
+#include <arpa/inet.h>
 
 #include <linux/can.h>
 #include <linux/can/raw.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
 
 #include "terminal.h"
 #include "lib.h"
@@ -76,12 +88,22 @@
 #define SOF_TIMESTAMPING_RX_SOFTWARE (1<<3)
 #define SOF_TIMESTAMPING_RAW_HARDWARE (1<<6)
 
-#define MAXSOCK 16    /* max. number of CAN interfaces given on the cmdline */
-#define MAXIFNAMES 30 /* size of receive name index to omit ioctls */
+#define MAXBATCH 1024 /* max. number of CAN frames per recvmmsg() syscall */
+#define MAXRING (1<<24) /* max. number of entries in the writer thread ring buffer */
+#define RINGLOGBUFSZ (1<<18) /* stdio buffer size for the log file in writer thread mode */
+#define WRITER_RINGSZ (1<<16) /* default ring size when log rotation/trigger enables the writer thread */
+#define TRIGGER_POST 5 /* default post trigger capture time in seconds */
+#define PACKET_BLOCKSZ (1<<16) /* AF_PACKET TPACKET_V3 ring block size */
+#define PACKET_FRAMESZ 256 /* AF_PACKET TPACKET_V3 ring frame size (for the setup) */
+#define PACKET_RINGSZ (1<<21) /* default AF_PACKET ring size per socket */
+#define PACKET_RETIRE_TOV 10 /* ms until a partly filled ring block is handed over */
 #define MAXCOL 6      /* number of different colors for colorized output */
 #define ANYDEV "any"  /* name of interface to receive from any CAN interface */
 #define ANL "\r\n"    /* newline in ASC mode */
 
+/* control message space for timestamps and the SO_RXQ_OVFL drop counter */
+#define CTRLMSG_LEN CMSG_SPACE(sizeof(struct timeval) + 3*sizeof(struct timespec) + sizeof(__u32))
+
 #define SILENT_INI 42 /* detect user setting on commandline */
 #define SILENT_OFF 0  /* no silent mode */
 #define SILENT_ANI 1  /* silent mode with animation */
@@ -98,11 +120,24 @@
 const char col_on [MAXCOL][19] = {BLUE, RED, GREEN, BOLD, MAGENTA, CYAN};
 const char col_off [] = ATTRESET;
 
-static char *cmdlinename[MAXSOCK];
-static __u32 dropcnt[MAXSOCK];
-static __u32 last_dropcnt[MAXSOCK];
-static char devname[MAXIFNAMES][IFNAMSIZ+1];
-static int  dindex[MAXIFNAMES];
+struct if_info { /* bundled information per open socket */
+	int s; /* socket */
+	char *cmdlinename;
+	__u32 dropcnt;
+	__u32 last_dropcnt;
+
+	/* AF_PACKET capture with filtering in userspace */
+	unsigned char *map; /* mmap'ed TPACKET_V3 ring */
+	unsigned int block_nr;
+	unsigned int block; /* next block to be processed */
+	struct can_filter *rfilter;
+	int numfilter;
+	int join_filter;
+	can_err_mask_t err_mask;
+};
+static struct if_info *sock_info;
+
+static struct ifcache ifcache; /* interface index to name cache */
 static int  max_devname_len; /* to prevent frazzled device name output */ 
 const int canfd_on = 1;
 
@@ -114,6 +149,79 @@ extern int optind, opterr, optopt;
 
 static volatile int running = 1;
 
+/* output settings - used by the receive loop or the writer thread */
+static unsigned char timestamp = 0;
+static unsigned char extra_msg_info = 0;
+static unsigned char silent = SILENT_INI;
+static unsigned char silentani = 0;
+static unsigned char color = 0;
+static unsigned char view = 0;
+static unsigned char log = 0;
+static unsigned char logbin = 0;
+static unsigned char logfrmt = 0;
+static struct timeval last_tv;
+static FILE *logfile = NULL;
+static struct binlog binlog;
+static unsigned long long logsize; /* bytes written to the current ASCII log file */
+static unsigned long long rotate_size; /* rotate log file after this size */
+static unsigned int rotate_interval; /* rotate log file every x seconds (wall clock) */
+static time_t rotate_time; /* next time based log file rotation */
+static unsigned int segment; /* number of the current log file segment */
+static unsigned char preallocated;
+
+#define ENTRY_FRAME 0   /* received CAN frame */
+#define ENTRY_DROP 1    /* frames dropped by the kernel (SO_RXQ_OVFL) */
+#define ENTRY_OVERRUN 2 /* frames dropped due to a full ring buffer */
+#define ENTRY_TRIGGER 3 /* trigger request by SIGUSR1 */
+#define ENTRY_LINK 4    /* pending RTNETLINK link notifications */
+
+struct rx_entry { /* received CAN frame and its meta data for the output */
+	struct canfd_frame frame;
+	struct timespec ts;
+	int type;
+	int ifindex;
+	int mtu;
+	int tx; /* frame has been sent by the local host */
+	__u32 drops;
+	__u32 total_drops;
+};
+
+/*
+ * Lock-free single producer / single consumer ring buffer between the
+ * receive loop (producer) and the writer thread (consumer). The indices
+ * are free running and only written by their owner.
+ */
+static struct {
+	struct rx_entry *entries;
+	unsigned int mask;
+	unsigned int head; /* written by the receive loop */
+	unsigned int tail __attribute__((aligned(64))); /* written by the writer thread */
+	int waiting __attribute__((aligned(64))); /* writer thread waits on efd */
+	int stop;
+	int efd;
+	unsigned int pending_overruns;
+	unsigned long long overruns;
+} ring;
+
+/*
+ * Trigger capture: the entries are held in a circular history buffer and
+ * only written into a new log file when a trigger condition is detected.
+ * The capture continues for 'post' seconds after the (last) trigger.
+ */
+static struct {
+	struct rx_entry *entries; /* pre-trigger history */
+	unsigned int size;
+	unsigned int head;
+	unsigned int fill;
+	struct canfd_frame *match; /* can_id/data triggers */
+	int nmatch;
+	unsigned char on_error; /* trigger on error frames */
+	unsigned int post;
+	int active;
+	struct timespec end; /* end of post trigger capture (CLOCK_MONOTONIC) */
+} trig;
+static volatile sig_atomic_t trigger_request;
+
 void print_usage(char *prg)
 {
 	fprintf(stderr, "%s - dump CAN bus traffic.\n", prg);
@@ -128,6 +236,7 @@ void print_usage(char *prg)
 	fprintf(stderr, "         -S          (swap byte order in printed CAN data[] - marked with '%c' )\n", SWAP_DELIMITER);
 	fprintf(stderr, "         -s <level>  (silent mode - %d: off (default) %d: animation %d: silent)\n", SILENT_OFF, SILENT_ANI, SILENT_ON);
 	fprintf(stderr, "         -l          (log CAN-frames into file. Sets '-s %d' by default)\n", SILENT_ON);
+	fprintf(stderr, "         -b          (use compact binary log file format. Implies '-l')\n");
 	fprintf(stderr, "         -L          (use log file format on stdout)\n");
 	fprintf(stderr, "         -n <count>  (terminate after reception of <count> CAN frames)\n");
 	fprintf(stderr, "         -r <size>   (set socket receive buffer to <size>)\n");
@@ -136,8 +245,16 @@ void print_usage(char *prg)
 	fprintf(stderr, "         -e          (dump CAN error frames in human-readable format)\n");
 	fprintf(stderr, "         -x          (print extra message infos, rx/tx brs esi)\n");
 	fprintf(stderr, "         -T <msecs>  (terminate after <msecs> without any reception)\n");
+	fprintf(stderr, "         -m <count>  (receive up to <count> CAN frames per syscall - default 1, max %d)\n", MAXBATCH);
+	fprintf(stderr, "         -w <size>   (format & write in a separate thread using a ring buffer of <size> frames)\n");
+	fprintf(stderr, "         -P          (capture via AF_PACKET TPACKET_V3 mmap ring. '-r' sets the ring size)\n");
+	fprintf(stderr, "         -R <mbytes> (rotate the log file after <mbytes> MiB. Implies '-l' and '-w %d')\n", WRITER_RINGSZ);
+	fprintf(stderr, "         -I <secs>   (rotate the log file every <secs> seconds. Implies '-l' and '-w %d')\n", WRITER_RINGSZ);
+	fprintf(stderr, "         -k <mbytes> (keep <mbytes> MiB of CAN frames in memory and log them on trigger only. Implies '-l' and '-w %d')\n", WRITER_RINGSZ);
+	fprintf(stderr, "         -g <trigger> (trigger for '-k': 'E' for error frames (enables all error frames without '#<error_mask>') or <can_id>#{data} - see cansend. SIGUSR1 always triggers)\n");
+	fprintf(stderr, "         -p <secs>   (continue logging <secs> seconds after the last trigger - default %d)\n", TRIGGER_POST);
 	fprintf(stderr, "\n");
-	fprintf(stderr, "Up to %d CAN interfaces with optional filter sets can be specified\n", MAXSOCK);
+	fprintf(stderr, "Multiple CAN interfaces with optional filter sets can be specified\n");
 	fprintf(stderr, "on the commandline in the form: <ifname>[,filter]*\n");
 	fprintf(stderr, "\nFilters:\n");
 	fprintf(stderr, "  Comma separated filters can be specified for each given CAN interface:\n");
@@ -164,98 +281,796 @@ void sigterm(int signo)
 	running = 0;
 }
 
-int idx2dindex(int ifidx, int socket) {
+void sigusr1(int signo)
+{
+	trigger_request = 1;
+}
+
+static inline int idx2dindex(int ifidx)
+{
+	int i = ifcache_index(&ifcache, ifidx);
+
+	if (max_devname_len < ifcache.max_len)
+		max_devname_len = ifcache.max_len;
+
+	return i;
+}
+
+int open_logfile(void)
+{
+	time_t currtime;
+	struct tm now;
+	char fname[83]; /* suggested by -Wformat-overflow= */
+
+	if (time(&currtime) == (time_t)-1) {
+		perror("time");
+		return 1;
+	}
+
+	localtime_r(&currtime, &now);
+
+	if (rotate_size || rotate_interval || trig.entries)
+		sprintf(fname, "candump-%04d-%02d-%02d_%02d%02d%02d_%04u.%s",
+			now.tm_year + 1900,
+			now.tm_mon + 1,
+			now.tm_mday,
+			now.tm_hour,
+			now.tm_min,
+			now.tm_sec,
+			segment++ % 10000,
+			(logbin)?"bin":"log");
+	else
+		sprintf(fname, "candump-%04d-%02d-%02d_%02d%02d%02d.%s",
+			now.tm_year + 1900,
+			now.tm_mon + 1,
+			now.tm_mday,
+			now.tm_hour,
+			now.tm_min,
+			now.tm_sec,
+			(logbin)?"bin":"log");
+
+	fprintf(stderr, "Enabling Logfile '%s'\n", fname);
+
+	logfile = fopen(fname, "w");
+	if (!logfile) {
+		perror("logfile");
+		return 1;
+	}
+
+	/* let the writer thread write the log file in large blocks */
+	if (ring.entries)
+		setvbuf(logfile, NULL, _IOFBF, RINGLOGBUFSZ);
+
+	/*
+	 * Allocate the whole segment in advance without changing the file
+	 * size to avoid fragmentation by growing the file on each write.
+	 * Not all filesystems support this - then just go ahead.
+	 */
+	preallocated = 0;
+	if (rotate_size && !fallocate(fileno(logfile), FALLOC_FL_KEEP_SIZE,
+				      0, rotate_size))
+		preallocated = 1;
+
+	if (rotate_interval)
+		rotate_time = (currtime / rotate_interval + 1) * rotate_interval;
+
+	logsize = 0;
+
+	if (logbin && binlog_open_write(&binlog, logfile)) {
+		perror("logfile");
+		return 1;
+	}
+
+	return 0;
+}
+
+int close_logfile(void)
+{
+	int ret = 0;
+
+	if (logbin)
+		binlog_close(&binlog);
+
+	/* release the unused pre-allocated space */
+	if (preallocated && (fflush(logfile) ||
+			     ftruncate(fileno(logfile), ftello(logfile))))
+		ret = 1;
+
+	if (fclose(logfile))
+		ret = 1;
+
+	logfile = NULL;
+
+	return ret;
+}
+
+static inline int rotate_logfile(void)
+{
+	unsigned long long size = (logbin)?binlog.size:logsize;
+
+	if (!(rotate_size && size >= rotate_size) &&
+	    !(rotate_interval && time(NULL) >= rotate_time))
+		return 0;
+
+	/* the frames wait in the ring buffer while switching the files */
+	if (close_logfile())
+		return 1;
+
+	return open_logfile();
+}
+
+int log_entry(struct rx_entry *e)
+{
+	char buf[CL_CFSZ]; /* max length */
+	int idx;
+
+	if ((rotate_size || rotate_interval) && rotate_logfile())
+		return 1;
+
+	if (e->type == ENTRY_OVERRUN) {
+		if (!logbin)
+			logsize += fprintf(logfile, "RINGOVERRUN: dropped %d CAN frame%s in ring buffer (total overruns %d)\n",
+					   e->drops, (e->drops > 1)?"s":"", e->total_drops);
+		return 0;
+	}
+
+	idx = idx2dindex(e->ifindex);
+
+	if (e->type == ENTRY_DROP) {
+		if (logbin)
+			return binlog_write_drop(&binlog, &e->ts, idx, ifcache.entry[idx].name,
+						 e->drops, e->total_drops);
+
+		logsize += fprintf(logfile, "DROPCOUNT: dropped %d CAN frame%s on '%s' socket (total drops %d)\n",
+				   e->drops, (e->drops > 1)?"s":"", ifcache.entry[idx].name, e->total_drops);
+		return 0;
+	}
+
+	if (logbin) /* log raw CAN frame with nanosecond timestamp & device */
+		return binlog_write_frame(&binlog, &e->ts, idx, ifcache.entry[idx].name, &e->frame,
+					  e->mtu, (e->tx)?BINLOG_FLAG_TX:0);
+
+	/* log CAN frame with absolute timestamp & device */
+	sprint_canframe(buf, &e->frame, 0,
+			(e->mtu == CANFD_MTU)?CANFD_MAX_DLEN:CAN_MAX_DLEN);
+	logsize += fprintf(logfile, "(%010lu.%06lu) %*s %s%s\n",
+			   (unsigned long)e->ts.tv_sec, (unsigned long)e->ts.tv_nsec/1000,
+			   max_devname_len, ifcache.entry[idx].name, buf,
+			   (extra_msg_info)?((e->tx)?" T":" R"):"");
+	return 0;
+}
 
+static int trigger_hit(struct rx_entry *e)
+{
+	struct canfd_frame *cf = &e->frame;
 	int i;
-	struct ifreq ifr;
 
-	for (i=0; i < MAXIFNAMES; i++) {
-		if (dindex[i] == ifidx)
-			return i;
+	if (e->type == ENTRY_TRIGGER)
+		return 1;
+
+	if (e->type != ENTRY_FRAME)
+		return 0;
+
+	if (cf->can_id & CAN_ERR_FLAG)
+		return trig.on_error;
+
+	for (i = 0; i < trig.nmatch; i++) {
+		if (cf->can_id == trig.match[i].can_id &&
+		    cf->len >= trig.match[i].len &&
+		    !memcmp(cf->data, trig.match[i].data, trig.match[i].len))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void trigger_arm(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &trig.end);
+	trig.end.tv_sec += trig.post;
+	trig.active = 1;
+}
+
+/* milliseconds (rounded up) until the post trigger capture ends */
+static long long trigger_left(void)
+{
+	struct timespec now;
+	long long ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = (trig.end.tv_sec - now.tv_sec) * 1000000000LL +
+		trig.end.tv_nsec - now.tv_nsec;
+
+	return (ns > 0) ? (ns + 999999) / 1000000 : 0;
+}
+
+int trigger_expire(void)
+{
+	struct timespec now;
+
+	if (!trig.active)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec < trig.end.tv_sec ||
+	    (now.tv_sec == trig.end.tv_sec && now.tv_nsec < trig.end.tv_nsec))
+		return 0;
+
+	/* post trigger time is over - back to the history buffer */
+	trig.active = 0;
+
+	return close_logfile();
+}
+
+int capture_entry(struct rx_entry *e)
+{
+	unsigned int i;
+
+	if (trigger_expire())
+		return 1;
+
+	if (trig.active) {
+		if (trigger_hit(e))
+			trigger_arm(); /* extend the post trigger capture */
+
+		return (e->type == ENTRY_TRIGGER)?0:log_entry(e);
+	}
+
+	if (e->type != ENTRY_TRIGGER) {
+		trig.entries[trig.head] = *e;
+		if (++trig.head == trig.size)
+			trig.head = 0;
+		if (trig.fill < trig.size)
+			trig.fill++;
+	}
+
+	if (!trigger_hit(e))
+		return 0;
+
+	if (open_logfile())
+		return 1;
+
+	/* write the pre-trigger history (including the trigger) oldest first */
+	i = (trig.head + trig.size - trig.fill) % trig.size;
+	for (; trig.fill; trig.fill--) {
+		if (log_entry(&trig.entries[i]))
+			return 1;
+		if (++i == trig.size)
+			i = 0;
+	}
+
+	trigger_arm();
+
+	return 0;
+}
+
+int output_entry(struct rx_entry *e)
+{
+	struct canfd_frame *frame = &e->frame;
+	struct timeval tv;
+	char *extra_info = "";
+	int idx, maxdlen;
+
+	if (e->type == ENTRY_LINK) {
+		ifcache_update(&ifcache);
+		return 0;
+	}
+
+	if (log) {
+		if (trig.entries) {
+			if (capture_entry(e))
+				return 1;
+		} else if (log_entry(e))
+			return 1;
+	}
+
+	if (e->type == ENTRY_TRIGGER)
+		return 0;
+
+	tv.tv_sec = e->ts.tv_sec;
+	tv.tv_usec = e->ts.tv_nsec/1000;
+
+	if (e->type == ENTRY_OVERRUN) {
+
+		__u32 frames = e->drops;
+
+		if (silent != SILENT_ON)
+			printf("RINGOVERRUN: dropped %d CAN frame%s in ring buffer (total overruns %d)\n",
+			       frames, (frames > 1)?"s":"", e->total_drops);
+
+		return 0;
+	}
+
+	idx = idx2dindex(e->ifindex);
+
+	if (e->type == ENTRY_DROP) {
+
+		__u32 frames = e->drops;
+
+		if (silent != SILENT_ON)
+			printf("DROPCOUNT: dropped %d CAN frame%s on '%s' socket (total drops %d)\n",
+			       frames, (frames > 1)?"s":"", ifcache.entry[idx].name, e->total_drops);
+
+		return 0;
 	}
 
-	/* create new interface index cache entry */
+	if (e->mtu == CANFD_MTU)
+		maxdlen = CANFD_MAX_DLEN;
+	else
+		maxdlen = CAN_MAX_DLEN;
+
+	/* once we detected a EFF frame indent SFF frames accordingly */
+	if (frame->can_id & CAN_EFF_FLAG)
+		view |= CANLIB_VIEW_INDENT_SFF;
 
-	/* remove index cache zombies first */
-	for (i=0; i < MAXIFNAMES; i++) {
-		if (dindex[i]) {
-			ifr.ifr_ifindex = dindex[i];
-			if (ioctl(socket, SIOCGIFNAME, &ifr) < 0)
-				dindex[i] = 0;
+	if (extra_msg_info) {
+		if (e->tx)
+			extra_info = " T";
+		else
+			extra_info = " R";
+	}
+
+	if ((logfrmt) && (silent == SILENT_OFF)){
+		char buf[CL_CFSZ]; /* max length */
+
+		/* print CAN frame in log file style to stdout */
+		sprint_canframe(buf, frame, 0, maxdlen);
+		printf("(%010lu.%06lu) %*s %s%s\n",
+		       tv.tv_sec, tv.tv_usec,
+		       max_devname_len, ifcache.entry[idx].name, buf,
+		       extra_info);
+		return 0; /* no other output to stdout */
+	}
+
+	if (silent != SILENT_OFF){
+		if (silent == SILENT_ANI) {
+			printf("%c\b", anichar[silentani%=MAXANI]);
+			silentani++;
 		}
+		return 0; /* no other output to stdout */
 	}
 
-	for (i=0; i < MAXIFNAMES; i++)
-		if (!dindex[i]) /* free entry */
-			break;
+	printf(" %s", (color>2)?col_on[idx%MAXCOL]:"");
 
-	if (i == MAXIFNAMES) {
-		fprintf(stderr, "Interface index cache only supports %d interfaces.\n",
-		       MAXIFNAMES);
-		exit(1);
+	switch (timestamp) {
+
+	case 'a': /* absolute with timestamp */
+		printf("(%010lu.%06lu) ", tv.tv_sec, tv.tv_usec);
+		break;
+
+	case 'A': /* absolute with date */
+	{
+		struct tm tm;
+		char timestring[25];
+
+		tm = *localtime(&tv.tv_sec);
+		strftime(timestring, 24, "%Y-%m-%d %H:%M:%S", &tm);
+		printf("(%s.%06lu) ", timestring, tv.tv_usec);
+	}
+	break;
+
+	case 'd': /* delta */
+	case 'z': /* starting with zero */
+	{
+		struct timeval diff;
+
+		if (last_tv.tv_sec == 0)   /* first init */
+			last_tv = tv;
+		diff.tv_sec  = tv.tv_sec  - last_tv.tv_sec;
+		diff.tv_usec = tv.tv_usec - last_tv.tv_usec;
+		if (diff.tv_usec < 0)
+			diff.tv_sec--, diff.tv_usec += 1000000;
+		if (diff.tv_sec < 0)
+			diff.tv_sec = diff.tv_usec = 0;
+		printf("(%03lu.%06lu) ", diff.tv_sec, diff.tv_usec);
+
+		if (timestamp == 'd')
+			last_tv = tv; /* update for delta calculation */
+	}
+	break;
+
+	default: /* no timestamp output */
+		break;
 	}
 
-	dindex[i] = ifidx;
+	printf(" %s", (color && (color<3))?col_on[idx%MAXCOL]:"");
+	printf("%*s", max_devname_len, ifcache.entry[idx].name);
 
-	ifr.ifr_ifindex = ifidx;
-	if (ioctl(socket, SIOCGIFNAME, &ifr) < 0)
-		perror("SIOCGIFNAME");
+	if (extra_msg_info) {
 
-	if (max_devname_len < (int)strlen(ifr.ifr_name))
-		max_devname_len = strlen(ifr.ifr_name);
+		if (e->tx)
+			printf ("  TX %s", extra_m_info[frame->flags & 3]);
+		else
+			printf ("  RX %s", extra_m_info[frame->flags & 3]);
+	}
 
-	strcpy(devname[i], ifr.ifr_name);
+	printf("%s  ", (color==1)?col_off:"");
 
-#ifdef DEBUG
-	printf("new index %d (%s)\n", i, devname[i]);
-#endif
+	fprint_long_canframe(stdout, frame, NULL, view, maxdlen);
 
-	return i;
+	printf("%s", (color>1)?col_off:"");
+	printf("\n");
+
+	return 0;
+}
+
+static inline struct rx_entry *ring_slot(void)
+{
+	/* only the receive loop writes ring.head */
+	if (ring.head - __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE) > ring.mask)
+		return NULL; /* ring buffer full */
+
+	return &ring.entries[ring.head & ring.mask];
+}
+
+static inline void ring_commit(void)
+{
+	__atomic_store_n(&ring.head, ring.head + 1, __ATOMIC_RELEASE);
+}
+
+void ring_push(struct rx_entry *e)
+{
+	struct rx_entry *slot;
+
+	/* report former overruns first to keep the output in order */
+	if (ring.pending_overruns) {
+		slot = ring_slot();
+		if (!slot) {
+			ring.pending_overruns++;
+			ring.overruns++;
+			return;
+		}
+		slot->type = ENTRY_OVERRUN;
+		slot->ts = e->ts;
+		slot->drops = ring.pending_overruns;
+		slot->total_drops = ring.overruns;
+		ring_commit();
+		ring.pending_overruns = 0;
+	}
+
+	slot = ring_slot();
+	if (!slot) {
+		ring.pending_overruns++;
+		ring.overruns++;
+		return;
+	}
+
+	*slot = *e; /* only copy raw data - formatting is done by the writer */
+	ring_commit();
+}
+
+void ring_wakeup(void)
+{
+	/* pairs with the barrier in writer_thread() before sleeping */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring.waiting, __ATOMIC_RELAXED))
+		eventfd_write(ring.efd, 1);
+}
+
+static void writer_wait(void)
+{
+	struct pollfd pfd = { .fd = ring.efd, .events = POLLIN };
+	struct timespec now;
+	long long timeout = 0, left;
+	int timed = 0;
+	eventfd_t cnt;
+
+	/* wake up for the time based rotation also on a quiet bus */
+	if (rotate_interval && logfile) {
+		clock_gettime(CLOCK_REALTIME, &now);
+		timeout = (rotate_time - now.tv_sec) * 1000LL - now.tv_nsec / 1000000;
+		timed = 1;
+	}
+
+	/* ... and to close the capture file after the post trigger time */
+	if (trig.active) {
+		left = trigger_left();
+		if (!timed || left < timeout)
+			timeout = left;
+		timed = 1;
+	}
+
+	if (!timed) {
+		eventfd_read(ring.efd, &cnt);
+		return;
+	}
+
+	if (timeout <= 0)
+		return;
+	if (timeout >= INT_MAX)
+		timeout = INT_MAX - 1;
+
+	if (poll(&pfd, 1, timeout + 1) > 0)
+		eventfd_read(ring.efd, &cnt);
+}
+
+void *writer_thread(void *arg)
+{
+	unsigned int head, tail = 0;
+
+	while (1) {
+		head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+
+		if (head == tail) {
+			/* ring buffer is empty - time to flush the console output */
+			fflush(stdout);
+
+			if (__atomic_load_n(&ring.stop, __ATOMIC_ACQUIRE) &&
+			    __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE) == tail)
+				break;
+
+			__atomic_store_n(&ring.waiting, 1, __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&ring.head, __ATOMIC_RELAXED) == tail &&
+			    !__atomic_load_n(&ring.stop, __ATOMIC_RELAXED))
+				writer_wait();
+			__atomic_store_n(&ring.waiting, 0, __ATOMIC_RELAXED);
+
+			if ((rotate_interval && logfile && rotate_logfile()) ||
+			    trigger_expire()) {
+				perror("logfile");
+				exit(1);
+			}
+			continue;
+		}
+
+		for (; tail != head; tail++) {
+			if (output_entry(&ring.entries[tail & ring.mask])) {
+				perror("logfile");
+				exit(1);
+			}
+			/* release the processed entry to the receive loop */
+			__atomic_store_n(&ring.tail, tail + 1, __ATOMIC_RELEASE);
+		}
+	}
+
+	return NULL;
+}
+
+static inline int deliver_entry(struct rx_entry *e)
+{
+	if (ring.entries) {
+		ring_push(e);
+		return 0;
+	}
+
+	return output_entry(e);
+}
+
+int packet_setup(struct if_info *obj, int ifindex, int ringsize, int hwtimestamp)
+{
+	struct sockaddr_ll sll;
+	struct tpacket_req3 req;
+	const int version = TPACKET_V3;
+
+	/* only pass CAN and CAN FD frames to the ring (e.g. for 'any') */
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_CAN, 1, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_CANFD, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	struct sock_fprog bpf = {
+		.len = sizeof(code) / sizeof(code[0]),
+		.filter = code,
+	};
+
+	if (setsockopt(obj->s, SOL_SOCKET, SO_ATTACH_FILTER, &bpf, sizeof(bpf)) < 0) {
+		perror("setsockopt SO_ATTACH_FILTER");
+		return 1;
+	}
+
+	if (setsockopt(obj->s, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+		perror("setsockopt PACKET_VERSION TPACKET_V3 not supported by your Linux Kernel");
+		return 1;
+	}
+
+	if (hwtimestamp) {
+		const int timestamping_flags = SOF_TIMESTAMPING_RAW_HARDWARE;
+
+		if (setsockopt(obj->s, SOL_PACKET, PACKET_TIMESTAMP,
+			       &timestamping_flags, sizeof(timestamping_flags)) < 0) {
+			perror("setsockopt PACKET_TIMESTAMP");
+			return 1;
+		}
+	}
+
+	obj->block_nr = (ringsize ? ringsize : PACKET_RINGSZ) / PACKET_BLOCKSZ;
+	if (obj->block_nr < 2)
+		obj->block_nr = 2;
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = PACKET_BLOCKSZ;
+	req.tp_block_nr = obj->block_nr;
+	req.tp_frame_size = PACKET_FRAMESZ;
+	req.tp_frame_nr = (PACKET_BLOCKSZ / PACKET_FRAMESZ) * obj->block_nr;
+	req.tp_retire_blk_tov = PACKET_RETIRE_TOV;
+
+	if (setsockopt(obj->s, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		perror("setsockopt PACKET_RX_RING");
+		return 1;
+	}
+
+	obj->map = mmap(NULL, (size_t)PACKET_BLOCKSZ * obj->block_nr,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, obj->s, 0);
+	if (obj->map == MAP_FAILED) {
+		/* MAP_LOCKED may fail due to RLIMIT_MEMLOCK */
+		obj->map = mmap(NULL, (size_t)PACKET_BLOCKSZ * obj->block_nr,
+				PROT_READ | PROT_WRITE, MAP_SHARED, obj->s, 0);
+		if (obj->map == MAP_FAILED) {
+			obj->map = NULL;
+			perror("mmap");
+			return 1;
+		}
+	}
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = ifindex; /* 0 => any interface */
+
+	if (bind(obj->s, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		perror("bind");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int packet_filter(struct if_info *obj, struct canfd_frame *cf)
+{
+	/* apply the CAN_RAW filter semantics in userspace */
+	int i, match = 0;
+
+	if (cf->can_id & CAN_ERR_FLAG)
+		return !!(cf->can_id & obj->err_mask & CAN_ERR_MASK);
+
+	if (!obj->numfilter)
+		return 1; /* default filter 0:0 */
+
+	for (i = 0; i < obj->numfilter; i++) {
+		canid_t id = obj->rfilter[i].can_id;
+		canid_t mask = obj->rfilter[i].can_mask;
+		int hit = ((cf->can_id & mask) == (id & ~CAN_INV_FILTER & mask));
+
+		if (id & CAN_INV_FILTER)
+			hit = !hit;
+
+		if (hit)
+			match++;
+		else if (obj->join_filter)
+			return 0;
+	}
+
+	return !!match;
+}
+
+int packet_rx(struct if_info *obj, int *count, int dropmonitor)
+{
+	struct tpacket_block_desc *pbd;
+	struct tpacket3_hdr *ppd;
+	struct sockaddr_ll *sll;
+	struct rx_entry e;
+	unsigned int i, num_pkts;
+
+	while (running) {
+
+		pbd = (struct tpacket_block_desc *)(obj->map + (size_t)obj->block * PACKET_BLOCKSZ);
+
+		if (!(__atomic_load_n(&pbd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+			break; /* no more retired blocks */
+
+		if (dropmonitor && (pbd->hdr.bh1.block_status & TP_STATUS_LOSING)) {
+			struct tpacket_stats_v3 st;
+			socklen_t len = sizeof(st);
+
+			/* the statistics are reset on each read */
+			if (!getsockopt(obj->s, SOL_PACKET, PACKET_STATISTICS, &st, &len))
+				obj->dropcnt += st.tp_drops;
+		}
+
+		num_pkts = pbd->hdr.bh1.num_pkts;
+		ppd = (struct tpacket3_hdr *)((unsigned char *)pbd + pbd->hdr.bh1.offset_to_first_pkt);
+
+		for (i = 0; i < num_pkts && running; i++,
+			     ppd = (struct tpacket3_hdr *)((unsigned char *)ppd + ppd->tp_next_offset)) {
+
+			if (ppd->tp_snaplen != CAN_MTU && ppd->tp_snaplen != CANFD_MTU)
+				continue;
+
+			memcpy(&e.frame, (unsigned char *)ppd + ppd->tp_mac, ppd->tp_snaplen);
+			/* clear the unused CAN FD part behind a classic CAN frame */
+			if (ppd->tp_snaplen == CAN_MTU)
+				memset((unsigned char *)&e.frame + CAN_MTU, 0, CANFD_MTU - CAN_MTU);
+
+			if (!packet_filter(obj, &e.frame))
+				continue;
+
+			sll = (struct sockaddr_ll *)((unsigned char *)ppd +
+						     TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+			e.type = ENTRY_FRAME;
+			e.ts.tv_sec = ppd->tp_sec;
+			e.ts.tv_nsec = ppd->tp_nsec;
+			e.ifindex = sll->sll_ifindex;
+			e.mtu = ppd->tp_snaplen;
+			e.tx = (sll->sll_pkttype == PACKET_OUTGOING);
+
+			if (*count && (--*count == 0))
+				running = 0;
+
+			/* report drops before the frame that detected them */
+			if (obj->dropcnt != obj->last_dropcnt) {
+
+				struct rx_entry drop = {
+					.type = ENTRY_DROP,
+					.ts = e.ts,
+					.ifindex = e.ifindex,
+					.drops = obj->dropcnt - obj->last_dropcnt,
+					.total_drops = obj->dropcnt,
+				};
+
+				if (deliver_entry(&drop))
+					return 1;
+
+				obj->last_dropcnt = obj->dropcnt;
+			}
+
+			if (deliver_entry(&e))
+				return 1;
+		}
+
+		/* hand the whole block back to the kernel */
+		__atomic_store_n(&pbd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		obj->block = (obj->block + 1) % obj->block_nr;
+	}
+
+	return 0;
 }
 
 int main(int argc, char **argv)
 {
-	fd_set rdfs;
-	int s[MAXSOCK];
-	unsigned char timestamp = 0;
+	int fd_epoll;
+	struct epoll_event event_setup = {
+		.events = EPOLLIN | EPOLLET, /* edge triggered: drain until EAGAIN */
+	};
+	struct epoll_event *events_pending;
+	struct if_info *obj;
 	unsigned char hwtimestamp = 0;
 	unsigned char down_causes_exit = 1;
 	unsigned char dropmonitor = 0;
-	unsigned char extra_msg_info = 0;
-	unsigned char silent = SILENT_INI;
-	unsigned char silentani = 0;
-	unsigned char color = 0;
-	unsigned char view = 0;
-	unsigned char log = 0;
-	unsigned char logfrmt = 0;
+	unsigned char packetmode = 0;
+	unsigned char post_set = 0;
 	int count = 0;
+	int batch = 1;
+	unsigned int ringsize = 0;
+	pthread_t writer;
 	int rcvbuf_size = 0;
-	int opt, ret;
+	int opt, num_events;
 	int currmax, numfilter;
 	int join_filter;
 	char *ptr, *nptr;
 	struct sockaddr_can addr;
-	char ctrlmsg[CMSG_SPACE(sizeof(struct timeval) + 3*sizeof(struct timespec) + sizeof(__u32))];
-	struct iovec iov;
-	struct msghdr msg;
+	char (*ctrlmsg)[CTRLMSG_LEN];
+	struct iovec *iov;
+	struct mmsghdr *mmsg;
+	struct msghdr *msg;
+	struct sockaddr_can *rxaddr;
 	struct cmsghdr *cmsg;
 	struct can_filter *rfilter;
 	can_err_mask_t err_mask;
-	struct canfd_frame frame;
-	int nbytes, i, maxdlen;
+	struct rx_entry *rxentries;
+	int nbytes, i, j, num;
 	struct ifreq ifr;
-	struct timeval tv, last_tv;
-	struct timeval timeout, timeout_config = { 0, 0 }, *timeout_current = NULL;
-	FILE *logfile = NULL;
+	int timeout_ms = -1; /* default to no timeout */
 
 	signal(SIGTERM, sigterm);
 	signal(SIGHUP, sigterm);
 	signal(SIGINT, sigterm);
+	signal(SIGUSR1, sigusr1);
 
-	last_tv.tv_sec  = 0;
-	last_tv.tv_usec = 0;
-
-	while ((opt = getopt(argc, argv, "t:HciaSs:lDdxLn:r:heT:?")) != -1) {
+	while ((opt = getopt(argc, argv, "t:HciaSs:lbDdxLn:r:heT:m:w:PR:I:k:g:p:?")) != -1) {
 		switch (opt) {
 		case 't':
 			timestamp = optarg[0];
@@ -303,6 +1118,11 @@ int main(int argc, char **argv)
 			log = 1;
 			break;
 
+		case 'b':
+			log = 1;
+			logbin = 1;
+			break;
+
 		case 'D':
 			down_causes_exit = 0;
 			break;
@@ -311,6 +1131,10 @@ int main(int argc, char **argv)
 			dropmonitor = 1;
 			break;
 
+		case 'P':
+			packetmode = 1;
+			break;
+
 		case 'x':
 			extra_msg_info = 1;
 			break;
@@ -337,15 +1161,82 @@ int main(int argc, char **argv)
 
 		case 'T':
 			errno = 0;
-			timeout_config.tv_usec = strtol(optarg, NULL, 0);
-			if (errno != 0) {
+			timeout_ms = strtol(optarg, NULL, 0);
+			if (errno != 0 || timeout_ms < 0) {
+				print_usage(basename(argv[0]));
+				exit(1);
+			}
+			break;
+
+		case 'm':
+			batch = atoi(optarg);
+			if (batch < 1 || batch > MAXBATCH) {
+				print_usage(basename(argv[0]));
+				exit(1);
+			}
+			break;
+
+		case 'w':
+			ringsize = strtoul(optarg, NULL, 0);
+			if (ringsize < 1 || ringsize > MAXRING) {
+				print_usage(basename(argv[0]));
+				exit(1);
+			}
+			break;
+
+		case 'R':
+			rotate_size = strtoull(optarg, NULL, 0) << 20;
+			if (!rotate_size) {
+				print_usage(basename(argv[0]));
+				exit(1);
+			}
+			log = 1;
+			break;
+
+		case 'I':
+			rotate_interval = strtoul(optarg, NULL, 0);
+			if (!rotate_interval) {
+				print_usage(basename(argv[0]));
+				exit(1);
+			}
+			log = 1;
+			break;
+
+		case 'k':
+			trig.size = (strtoull(optarg, NULL, 0) << 20) / sizeof(*trig.entries);
+			if (!trig.size) {
+				print_usage(basename(argv[0]));
+				exit(1);
+			}
+			log = 1;
+			break;
+
+		case 'g':
+			if (!strcmp(optarg, "E")) {
+				trig.on_error = 1;
+				break;
+			}
+
+			trig.match = realloc(trig.match, (trig.nmatch + 1) * sizeof(*trig.match));
+			if (!trig.match) {
+				fprintf(stderr, "Failed to create trigger table!\n");
+				return 1;
+			}
+
+			memset(&trig.match[trig.nmatch], 0, sizeof(*trig.match));
+			if (!parse_canframe(optarg, &trig.match[trig.nmatch])) {
+				fprintf(stderr, "Wrong trigger format '%s'!\n", optarg);
 				print_usage(basename(argv[0]));
 				exit(1);
 			}
-			timeout_config.tv_sec = timeout_config.tv_usec / 1000;
-			timeout_config.tv_usec = (timeout_config.tv_usec % 1000) * 1000;
-			timeout_current = &timeout;
+			trig.nmatch++;
 			break;
+
+		case 'p':
+			trig.post = strtoul(optarg, NULL, 0);
+			post_set = 1;
+			break;
+
 		default:
 			print_usage(basename(argv[0]));
 			exit(1);
@@ -363,6 +1254,25 @@ int main(int argc, char **argv)
 		exit(0);
 	}
 
+	if ((trig.nmatch || trig.on_error || post_set) && !trig.size) {
+		fprintf(stderr, "Trigger options selected: Please enable the trigger buffer with '-k'!\n");
+		exit(1);
+	}
+
+	if (trig.size) {
+		trig.entries = calloc(trig.size, sizeof(*trig.entries));
+		if (!trig.entries) {
+			fprintf(stderr, "Failed to create trigger history buffer!\n");
+			return 1;
+		}
+		if (!post_set)
+			trig.post = TRIGGER_POST;
+	}
+
+	/* switch the log files in the writer thread - not in the receive loop */
+	if ((rotate_size || rotate_interval || trig.entries) && !ringsize)
+		ringsize = WRITER_RINGSZ;
+
 	if (silent == SILENT_INI) {
 		if (log) {
 			fprintf(stderr, "Disabled standard output while logging.\n");
@@ -373,13 +1283,22 @@ int main(int argc, char **argv)
 
 	currmax = argc - optind; /* find real number of CAN devices */
 
-	if (currmax > MAXSOCK) {
-		fprintf(stderr, "More than %d CAN devices given on commandline!\n", MAXSOCK);
+	sock_info = calloc(currmax, sizeof(*sock_info));
+	events_pending = calloc(currmax + 1, sizeof(*events_pending));
+	if (!sock_info || !events_pending) {
+		fprintf(stderr, "Failed to create socket information space!\n");
+		return 1;
+	}
+
+	fd_epoll = epoll_create1(0);
+	if (fd_epoll < 0) {
+		perror("epoll_create1");
 		return 1;
 	}
 
 	for (i=0; i < currmax; i++) {
 
+		obj = &sock_info[i];
 		ptr = argv[optind+i];
 		nptr = strchr(ptr, ',');
 
@@ -387,13 +1306,22 @@ int main(int argc, char **argv)
 		printf("open %d '%s'.\n", i, ptr);
 #endif
 
-		s[i] = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-		if (s[i] < 0) {
+		if (packetmode)
+			obj->s = socket(AF_PACKET, SOCK_RAW, 0); /* protocol set by bind() */
+		else
+			obj->s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+		if (obj->s < 0) {
 			perror("socket");
 			return 1;
 		}
 
-		cmdlinename[i] = ptr; /* save pointer to cmdline name of this socket */
+		event_setup.data.ptr = obj; /* remember the socket information */
+		if (epoll_ctl(fd_epoll, EPOLL_CTL_ADD, obj->s, &event_setup)) {
+			perror("epoll_ctl");
+			return 1;
+		}
+
+		obj->cmdlinename = ptr; /* save pointer to cmdline name of this socket */
 
 		if (nptr)
 			nbytes = nptr - ptr;  /* interface name is up the first ',' */
@@ -418,7 +1346,7 @@ int main(int argc, char **argv)
 #endif
 
 		if (strcmp(ANYDEV, ifr.ifr_name)) {
-			if (ioctl(s[i], SIOCGIFINDEX, &ifr) < 0) {
+			if (ioctl(obj->s, SIOCGIFINDEX, &ifr) < 0) {
 				perror("SIOCGIFINDEX");
 				exit(1);
 			}
@@ -426,6 +1354,8 @@ int main(int argc, char **argv)
 		} else
 			addr.can_ifindex = 0; /* any can interface */
 
+		err_mask = 0;
+
 		if (nptr) {
 
 			/* found a ',' after the interface name => check for filters */
@@ -477,26 +1407,52 @@ int main(int argc, char **argv)
 				}
 			}
 
+			if (packetmode) {
+				/* keep the filters for packet_filter() */
+				obj->rfilter = rfilter;
+				obj->numfilter = numfilter;
+				obj->join_filter = join_filter;
+				obj->err_mask = err_mask;
+				goto filter_done;
+			}
+
 			if (err_mask)
-				setsockopt(s[i], SOL_CAN_RAW, CAN_RAW_ERR_FILTER,
+				setsockopt(obj->s, SOL_CAN_RAW, CAN_RAW_ERR_FILTER,
 					   &err_mask, sizeof(err_mask));
 
-			if (join_filter && setsockopt(s[i], SOL_CAN_RAW, CAN_RAW_JOIN_FILTERS,
+			if (join_filter && setsockopt(obj->s, SOL_CAN_RAW, CAN_RAW_JOIN_FILTERS,
 						      &join_filter, sizeof(join_filter)) < 0) {
 				perror("setsockopt CAN_RAW_JOIN_FILTERS not supported by your Linux Kernel");
 				return 1;
 			}
 
 			if (numfilter)
-				setsockopt(s[i], SOL_CAN_RAW, CAN_RAW_FILTER,
+				setsockopt(obj->s, SOL_CAN_RAW, CAN_RAW_FILTER,
 					   rfilter, numfilter * sizeof(struct can_filter));
 
 			free(rfilter);
 
 		} /* if (nptr) */
 
+	filter_done:
+		/* the trigger on error frames needs error frames */
+		if (trig.on_error && !err_mask) {
+			err_mask = CAN_ERR_MASK;
+			if (packetmode)
+				obj->err_mask = err_mask;
+			else
+				setsockopt(obj->s, SOL_CAN_RAW, CAN_RAW_ERR_FILTER,
+					   &err_mask, sizeof(err_mask));
+		}
+
+		if (packetmode) {
+			if (packet_setup(obj, addr.can_ifindex, rcvbuf_size, hwtimestamp))
+				return 1;
+			continue; /* no further CAN_RAW socket settings */
+		}
+
 		/* try to switch the socket into CAN FD mode */
-		setsockopt(s[i], SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &canfd_on, sizeof(canfd_on));
+		setsockopt(obj->s, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &canfd_on, sizeof(canfd_on));
 
 		if (rcvbuf_size) {
 
@@ -504,18 +1460,18 @@ int main(int argc, char **argv)
 			socklen_t curr_rcvbuf_size_len = sizeof(curr_rcvbuf_size);
 
 			/* try SO_RCVBUFFORCE first, if we run with CAP_NET_ADMIN */
-			if (setsockopt(s[i], SOL_SOCKET, SO_RCVBUFFORCE,
+			if (setsockopt(obj->s, SOL_SOCKET, SO_RCVBUFFORCE,
 				       &rcvbuf_size, sizeof(rcvbuf_size)) < 0) {
 #ifdef DEBUG
 				printf("SO_RCVBUFFORCE failed so try SO_RCVBUF ...\n");
 #endif
-				if (setsockopt(s[i], SOL_SOCKET, SO_RCVBUF,
+				if (setsockopt(obj->s, SOL_SOCKET, SO_RCVBUF,
 					       &rcvbuf_size, sizeof(rcvbuf_size)) < 0) {
 					perror("setsockopt SO_RCVBUF");
 					return 1;
 				}
 
-				if (getsockopt(s[i], SOL_SOCKET, SO_RCVBUF,
+				if (getsockopt(obj->s, SOL_SOCKET, SO_RCVBUF,
 					       &curr_rcvbuf_size, &curr_rcvbuf_size_len) < 0) {
 					perror("getsockopt SO_RCVBUF");
 					return 1;
@@ -536,7 +1492,7 @@ int main(int argc, char **argv)
 								SOF_TIMESTAMPING_RX_SOFTWARE | \
 								SOF_TIMESTAMPING_RAW_HARDWARE);
 
-				if (setsockopt(s[i], SOL_SOCKET, SO_TIMESTAMPING,
+				if (setsockopt(obj->s, SOL_SOCKET, SO_TIMESTAMPING,
 						&timestamping_flags, sizeof(timestamping_flags)) < 0) {
 					perror("setsockopt SO_TIMESTAMPING is not supported by your Linux kernel");
 					return 1;
@@ -544,9 +1500,10 @@ int main(int argc, char **argv)
 			} else {
 				const int timestamp_on = 1;
 
-				if (setsockopt(s[i], SOL_SOCKET, SO_TIMESTAMP,
+				/* nanosecond resolution for the binary log file format */
+				if (setsockopt(obj->s, SOL_SOCKET, SO_TIMESTAMPNS,
 					       &timestamp_on, sizeof(timestamp_on)) < 0) {
-					perror("setsockopt SO_TIMESTAMP");
+					perror("setsockopt SO_TIMESTAMPNS");
 					return 1;
 				}
 			}
@@ -556,262 +1513,275 @@ int main(int argc, char **argv)
 
 			const int dropmonitor_on = 1;
 
-			if (setsockopt(s[i], SOL_SOCKET, SO_RXQ_OVFL,
+			if (setsockopt(obj->s, SOL_SOCKET, SO_RXQ_OVFL,
 				       &dropmonitor_on, sizeof(dropmonitor_on)) < 0) {
 				perror("setsockopt SO_RXQ_OVFL not supported by your Linux Kernel");
 				return 1;
 			}
 		}
 
-		if (bind(s[i], (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		if (bind(obj->s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
 			perror("bind");
 			return 1;
 		}
 	}
 
-	if (log) {
-		time_t currtime;
-		struct tm now;
-		char fname[83]; /* suggested by -Wformat-overflow= */
+	if (ifcache_open(&ifcache, sock_info[0].s)) {
+		fprintf(stderr, "Failed to create interface name cache!\n");
+		return 1;
+	}
 
-		if (time(&currtime) == (time_t)-1) {
-			perror("time");
+	/* get informed about renamed and removed interfaces */
+	if (ifcache.nl >= 0) {
+		event_setup.data.ptr = &ifcache;
+		if (epoll_ctl(fd_epoll, EPOLL_CTL_ADD, ifcache.nl, &event_setup)) {
+			perror("failed to add netlink socket to epoll");
 			return 1;
 		}
+	}
 
-		localtime_r(&currtime, &now);
+	if (ringsize) {
+		/* round up to a power of two for cheap index masking */
+		for (ring.mask = 1; ring.mask < ringsize; ring.mask <<= 1)
+			;
+		ring.entries = calloc(ring.mask, sizeof(*ring.entries));
+		if (!ring.entries) {
+			fprintf(stderr, "Failed to create ring buffer!\n");
+			return 1;
+		}
+		ring.mask--;
 
-		sprintf(fname, "candump-%04d-%02d-%02d_%02d%02d%02d.log",
-			now.tm_year + 1900,
-			now.tm_mon + 1,
-			now.tm_mday,
-			now.tm_hour,
-			now.tm_min,
-			now.tm_sec);
+		ring.efd = eventfd(0, 0);
+		if (ring.efd < 0) {
+			perror("eventfd");
+			return 1;
+		}
+	}
 
+	if (log) {
 		if (silent != SILENT_ON)
 			fprintf(stderr, "Warning: Console output active while logging!\n");
 
-		fprintf(stderr, "Enabling Logfile '%s'\n", fname);
-
-		logfile = fopen(fname, "w");
-		if (!logfile) {
-			perror("logfile");
+		/* in trigger mode the log files are created on demand */
+		if (!trig.entries && open_logfile())
 			return 1;
-		}
+	}
+
+	if (ring.entries && pthread_create(&writer, NULL, writer_thread, NULL)) {
+		fprintf(stderr, "Failed to create writer thread!\n");
+		return 1;
+	}
+
+	/* one frame entry, sender address and control buffer per batch entry */
+	rxentries = calloc(batch, sizeof(*rxentries));
+	rxaddr = calloc(batch, sizeof(*rxaddr));
+	ctrlmsg = calloc(batch, sizeof(*ctrlmsg));
+	iov = calloc(batch, sizeof(*iov));
+	mmsg = calloc(batch, sizeof(*mmsg));
+	if (!rxentries || !rxaddr || !ctrlmsg || !iov || !mmsg) {
+		fprintf(stderr, "Failed to create receive batch buffers!\n");
+		return 1;
 	}
 
 	/* these settings are static and can be held out of the hot path */
-	iov.iov_base = &frame;
-	msg.msg_name = &addr;
-	msg.msg_iov = &iov;
-	msg.msg_iovlen = 1;
-	msg.msg_control = &ctrlmsg;
+	for (j=0; j<batch; j++) {
+		iov[j].iov_base = &rxentries[j].frame;
+		mmsg[j].msg_hdr.msg_name = &rxaddr[j];
+		mmsg[j].msg_hdr.msg_iov = &iov[j];
+		mmsg[j].msg_hdr.msg_iovlen = 1;
+		mmsg[j].msg_hdr.msg_control = &ctrlmsg[j];
+	}
 
 	while (running) {
 
-		FD_ZERO(&rdfs);
-		for (i=0; i<currmax; i++)
-			FD_SET(s[i], &rdfs);
+		if (trigger_request) {
+			struct rx_entry e = { .type = ENTRY_TRIGGER };
 
-		if (timeout_current)
-			*timeout_current = timeout_config;
+			trigger_request = 0;
+			clock_gettime(CLOCK_REALTIME, &e.ts);
+			if (deliver_entry(&e)) {
+				perror("logfile");
+				return 1;
+			}
+			if (ring.entries)
+				ring_wakeup();
+		}
 
-		if ((ret = select(s[currmax-1]+1, &rdfs, NULL, NULL, timeout_current)) <= 0) {
-			//perror("select");
+		num_events = epoll_wait(fd_epoll, events_pending, currmax + 1, timeout_ms);
+		if (num_events == -1 && errno == EINTR)
+			continue; /* signal received - check running flag */
+		if (num_events <= 0) {
+			//perror("epoll_wait");
 			running = 0;
 			continue;
 		}
 
-		for (i=0; i<currmax; i++) {  /* check all CAN RAW sockets */
+		for (i=0; i<num_events; i++) {  /* check waiting CAN RAW sockets */
 
-			if (FD_ISSET(s[i], &rdfs)) {
+			if (events_pending[i].data.ptr == &ifcache) {
+				struct rx_entry e = { .type = ENTRY_LINK };
 
-				int idx;
-				char *extra_info = "";
-
-				/* these settings may be modified by recvmsg() */
-				iov.iov_len = sizeof(frame);
-				msg.msg_namelen = sizeof(addr);
-				msg.msg_controllen = sizeof(ctrlmsg);  
-				msg.msg_flags = 0;
+				/* process the notifications in order with the frames */
+				deliver_entry(&e);
+				if (ring.entries)
+					ring_wakeup();
+				continue;
+			}
 
-				nbytes = recvmsg(s[i], &msg, 0);
-				idx = idx2dindex(addr.can_ifindex, s[i]);
+			obj = events_pending[i].data.ptr;
 
-				if (nbytes < 0) {
-					if ((errno == ENETDOWN) && !down_causes_exit) {
-						fprintf(stderr, "%s: interface down\n", devname[idx]);
-						continue;
-					}
-					perror("read");
+			if (obj->map) {
+				/* edge triggered: process all retired ring blocks */
+				if (packet_rx(obj, &count, dropmonitor)) {
+					perror("logfile");
 					return 1;
 				}
 
-				if ((size_t)nbytes == CAN_MTU)
-					maxdlen = CAN_MAX_DLEN;
-				else if ((size_t)nbytes == CANFD_MTU)
-					maxdlen = CANFD_MAX_DLEN;
-				else {
-					fprintf(stderr, "read: incomplete CAN frame\n");
-					return 1;
-				}
+				if (ring.entries)
+					ring_wakeup();
+				else
+					fflush(stdout);
 
-				if (count && (--count == 0))
-					running = 0;
-		    
-				for (cmsg = CMSG_FIRSTHDR(&msg);
-				     cmsg && (cmsg->cmsg_level == SOL_SOCKET);
-				     cmsg = CMSG_NXTHDR(&msg,cmsg)) {
-					if (cmsg->cmsg_type == SO_TIMESTAMP) {
-						memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
-					} else if (cmsg->cmsg_type == SO_TIMESTAMPING) {
-
-						struct timespec *stamp = (struct timespec *)CMSG_DATA(cmsg);
-
-						/*
-						 * stamp[0] is the software timestamp
-						 * stamp[1] is deprecated
-						 * stamp[2] is the raw hardware timestamp
-						 * See chapter 2.1.2 Receive timestamps in
-						 * linux/Documentation/networking/timestamping.txt
-						 */
-						tv.tv_sec = stamp[2].tv_sec;
-						tv.tv_usec = stamp[2].tv_nsec/1000;
-					} else if (cmsg->cmsg_type == SO_RXQ_OVFL)
-						memcpy(&dropcnt[i], CMSG_DATA(cmsg), sizeof(__u32));
-				}
-
-				/* check for (unlikely) dropped frames on this specific socket */
-				if (dropcnt[i] != last_dropcnt[i]) {
-
-					__u32 frames = dropcnt[i] - last_dropcnt[i];
-
-					if (silent != SILENT_ON)
-						printf("DROPCOUNT: dropped %d CAN frame%s on '%s' socket (total drops %d)\n",
-						       frames, (frames > 1)?"s":"", devname[idx], dropcnt[i]);
-
-					if (log)
-						fprintf(logfile, "DROPCOUNT: dropped %d CAN frame%s on '%s' socket (total drops %d)\n",
-							frames, (frames > 1)?"s":"", devname[idx], dropcnt[i]);
+				continue;
+			}
 
-					last_dropcnt[i] = dropcnt[i];
+			/* edge triggered: drain the socket until it runs empty */
+			do {
+				/* these settings may be modified by recvmmsg() */
+				for (j=0; j<batch; j++) {
+					iov[j].iov_len = sizeof(rxentries[j].frame);
+					mmsg[j].msg_hdr.msg_namelen = sizeof(rxaddr[j]);
+					mmsg[j].msg_hdr.msg_controllen = sizeof(ctrlmsg[j]);
+					mmsg[j].msg_hdr.msg_flags = 0;
 				}
 
-				/* once we detected a EFF frame indent SFF frames accordingly */
-				if (frame.can_id & CAN_EFF_FLAG)
-					view |= CANLIB_VIEW_INDENT_SFF;
-
-				if (extra_msg_info) {
-					if (msg.msg_flags & MSG_DONTROUTE)
-						extra_info = " T";
-					else
-						extra_info = " R";
+				/* fetch all pending frames up to the batch size at once */
+				num = recvmmsg(obj->s, mmsg, batch, MSG_DONTWAIT, NULL);
+				if (num < 0) {
+					if (errno == EAGAIN || errno == EWOULDBLOCK)
+						break; /* socket is empty */
+					if ((errno == ENETDOWN) && !down_causes_exit) {
+						fprintf(stderr, "%s: interface down\n", obj->cmdlinename);
+						break;
+					}
+					perror("read");
+					return 1;
 				}
 
-				if (log) {
-					char buf[CL_CFSZ]; /* max length */
+				/* process the whole batch in one pass */
+				for (j=0; j<num; j++) {
 
-					/* log CAN frame with absolute timestamp & device */
-					sprint_canframe(buf, &frame, 0, maxdlen);
-					fprintf(logfile, "(%010lu.%06lu) %*s %s%s\n",
-						tv.tv_sec, tv.tv_usec,
-						max_devname_len, devname[idx], buf,
-						extra_info);
-				}
+					struct rx_entry *e = &rxentries[j];
 
-				if ((logfrmt) && (silent == SILENT_OFF)){
-					char buf[CL_CFSZ]; /* max length */
+					msg = &mmsg[j].msg_hdr;
+					nbytes = mmsg[j].msg_len;
 
-					/* print CAN frame in log file style to stdout */
-					sprint_canframe(buf, &frame, 0, maxdlen);
-					printf("(%010lu.%06lu) %*s %s%s\n",
-					       tv.tv_sec, tv.tv_usec,
-					       max_devname_len, devname[idx], buf,
-					       extra_info);
-					goto out_fflush; /* no other output to stdout */
-				}
+					if ((size_t)nbytes != CAN_MTU && (size_t)nbytes != CANFD_MTU) {
+						fprintf(stderr, "read: incomplete CAN frame\n");
+						return 1;
+					}
 
-				if (silent != SILENT_OFF){
-					if (silent == SILENT_ANI) {
-						printf("%c\b", anichar[silentani%=MAXANI]);
-						silentani++;
+					if (count && (--count == 0)) {
+						running = 0;
+						num = j+1; /* omit the rest of this batch */
 					}
-					goto out_fflush; /* no other output to stdout */
-				}
-		      
-				printf(" %s", (color>2)?col_on[idx%MAXCOL]:"");
 
-				switch (timestamp) {
+					for (cmsg = CMSG_FIRSTHDR(msg);
+					     cmsg && (cmsg->cmsg_level == SOL_SOCKET);
+					     cmsg = CMSG_NXTHDR(msg,cmsg)) {
+						if (cmsg->cmsg_type == SO_TIMESTAMPNS) {
+							memcpy(&e->ts, CMSG_DATA(cmsg), sizeof(e->ts));
+						} else if (cmsg->cmsg_type == SO_TIMESTAMPING) {
+
+							struct timespec *stamp = (struct timespec *)CMSG_DATA(cmsg);
+
+							/*
+							 * stamp[0] is the software timestamp
+							 * stamp[1] is deprecated
+							 * stamp[2] is the raw hardware timestamp
+							 * See chapter 2.1.2 Receive timestamps in
+							 * linux/Documentation/networking/timestamping.txt
+							 */
+							e->ts = stamp[2];
+						} else if (cmsg->cmsg_type == SO_RXQ_OVFL)
+							memcpy(&obj->dropcnt, CMSG_DATA(cmsg), sizeof(__u32));
+					}
 
-				case 'a': /* absolute with timestamp */
-					printf("(%010lu.%06lu) ", tv.tv_sec, tv.tv_usec);
-					break;
+					e->type = ENTRY_FRAME;
+					e->ifindex = rxaddr[j].can_ifindex;
+					e->mtu = nbytes;
+					e->tx = !!(msg->msg_flags & MSG_DONTROUTE);
 
-				case 'A': /* absolute with date */
-				{
-					struct tm tm;
-					char timestring[25];
+					/* check for (unlikely) dropped frames on this specific socket */
+					if (obj->dropcnt != obj->last_dropcnt) {
 
-					tm = *localtime(&tv.tv_sec);
-					strftime(timestring, 24, "%Y-%m-%d %H:%M:%S", &tm);
-					printf("(%s.%06lu) ", timestring, tv.tv_usec);
-				}
-				break;
+						struct rx_entry drop = {
+							.type = ENTRY_DROP,
+							.ts = e->ts,
+							.ifindex = e->ifindex,
+							.drops = obj->dropcnt - obj->last_dropcnt,
+							.total_drops = obj->dropcnt,
+						};
 
-				case 'd': /* delta */
-				case 'z': /* starting with zero */
-				{
-					struct timeval diff;
-
-					if (last_tv.tv_sec == 0)   /* first init */
-						last_tv = tv;
-					diff.tv_sec  = tv.tv_sec  - last_tv.tv_sec;
-					diff.tv_usec = tv.tv_usec - last_tv.tv_usec;
-					if (diff.tv_usec < 0)
-						diff.tv_sec--, diff.tv_usec += 1000000;
-					if (diff.tv_sec < 0)
-						diff.tv_sec = diff.tv_usec = 0;
-					printf("(%03lu.%06lu) ", diff.tv_sec, diff.tv_usec);
-				
-					if (timestamp == 'd')
-						last_tv = tv; /* update for delta calculation */
-				}
-				break;
+						if (deliver_entry(&drop)) {
+							perror("logfile");
+							return 1;
+						}
 
-				default: /* no timestamp output */
-					break;
-				}
-
-				printf(" %s", (color && (color<3))?col_on[idx%MAXCOL]:"");
-				printf("%*s", max_devname_len, devname[idx]);
-
-				if (extra_msg_info) {
+						obj->last_dropcnt = obj->dropcnt;
+					}
 
-					if (msg.msg_flags & MSG_DONTROUTE)
-						printf ("  TX %s", extra_m_info[frame.flags & 3]);
-					else
-						printf ("  RX %s", extra_m_info[frame.flags & 3]);
+					if (deliver_entry(e)) {
+						perror("logfile");
+						return 1;
+					}
 				}
 
-				printf("%s  ", (color==1)?col_off:"");
+				if (ring.entries)
+					ring_wakeup();
+				else
+					fflush(stdout);
 
-				fprint_long_canframe(stdout, &frame, NULL, view, maxdlen);
+			} while (num == batch && running);
+		}
+	}
 
-				printf("%s", (color>1)?col_off:"");
-				printf("\n");
-			}
+	if (ring.entries) {
+		/* let the writer thread process the remaining entries */
+		__atomic_store_n(&ring.stop, 1, __ATOMIC_RELEASE);
+		eventfd_write(ring.efd, 1);
+		pthread_join(writer, NULL);
+		close(ring.efd);
+		free(ring.entries);
+
+		if (ring.overruns)
+			fprintf(stderr, "Counted %llu ring buffer overruns (dropped CAN frames).\n",
+				ring.overruns);
+	}
 
-		out_fflush:
-			fflush(stdout);
-		}
+	for (i=0; i<currmax; i++) {
+		if (sock_info[i].map)
+			munmap(sock_info[i].map, (size_t)PACKET_BLOCKSZ * sock_info[i].block_nr);
+		free(sock_info[i].rfilter);
+		close(sock_info[i].s);
 	}
 
-	for (i=0; i<currmax; i++)
-		close(s[i]);
+	close(fd_epoll);
+	ifcache_close(&ifcache);
+
+	if (logfile && close_logfile())
+		perror("logfile");
+
+	free(trig.entries);
+	free(trig.match);
 
-	if (log)
-		fclose(logfile);
+	free(mmsg);
+	free(iov);
+	free(ctrlmsg);
+	free(rxaddr);
+	free(rxentries);
+	free(events_pending);
+	free(sock_info);
 
 	return 0;
 }
@@ -47,7 +47,6 @@
 #include "canframelen.h"
 #include <stdint.h>
 #include <stddef.h>
-#include <stdbool.h>
 #include <string.h>
 #include <assert.h>
 #include <arpa/inet.h>
@@ -112,43 +111,265 @@ static crc_t crc_update_bytewise(crc_t crc, const unsigned char *data, size_t da
 	return crc & 0x7fff;
 }
 
+/*
+ * Bit stuffing state machine
+ *
+ * The state holds the value of the last bit and the number of equal bits
+ * in a row (1..5). After five equal bits a stuff bit is pending: it is
+ * counted when the next bit follows and starts a new run with the inverse
+ * value. So a stuff bit behind the last processed bit is left pending in
+ * the state and the processing of a bit range can be split at any bit.
+ *
+ * The table entries contain the new state in the low nibble and the number
+ * of inserted stuff bits in the high nibble.
+ */
+#define STUFF_STATE(bit, n)	((bit) * 5 + (n) - 1)
+
+/* state transitions for a single bit */
+static const uint8_t stuff_bit_table[10][2] = {
+	{ 0x01, 0x05 }, /* last bit 0, 1 equal bits */
+	{ 0x02, 0x05 }, /* last bit 0, 2 equal bits */
+	{ 0x03, 0x05 }, /* last bit 0, 3 equal bits */
+	{ 0x04, 0x05 }, /* last bit 0, 4 equal bits */
+	{ 0x10, 0x16 }, /* last bit 0, 5 equal bits */
+	{ 0x00, 0x06 }, /* last bit 1, 1 equal bits */
+	{ 0x00, 0x07 }, /* last bit 1, 2 equal bits */
+	{ 0x00, 0x08 }, /* last bit 1, 3 equal bits */
+	{ 0x00, 0x09 }, /* last bit 1, 4 equal bits */
+	{ 0x11, 0x15 }, /* last bit 1, 5 equal bits */
+};
+
+/* state transitions for the eight bits of a byte (MSB first) */
+static const uint8_t stuff_table[10][256] = {
+	{ /* last bit 0, 1 equal bits */
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x19,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x11, 0x15,
+		0x10, 0x16, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x12, 0x15, 0x10, 0x16,
+		0x11, 0x15, 0x10, 0x17, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x11, 0x15,
+		0x10, 0x16, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17
+	},
+	{ /* last bit 0, 2 equal bits */
+		0x14, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x21, 0x25,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x11, 0x15,
+		0x10, 0x16, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x12, 0x15, 0x10, 0x16,
+		0x11, 0x15, 0x10, 0x17, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x11, 0x15,
+		0x10, 0x16, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17
+	},
+	{ /* last bit 0, 3 equal bits */
+		0x20, 0x26, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x19,
+		0x14, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x22, 0x25, 0x20, 0x26,
+		0x10, 0x16, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x12, 0x15, 0x10, 0x16,
+		0x11, 0x15, 0x10, 0x17, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x11, 0x15,
+		0x10, 0x16, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17
+	},
+	{ /* last bit 0, 4 equal bits */
+		0x21, 0x25, 0x20, 0x27, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x19,
+		0x14, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x21, 0x25,
+		0x20, 0x26, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x19,
+		0x14, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x23, 0x25, 0x20, 0x26, 0x21, 0x25, 0x20, 0x27,
+		0x11, 0x15, 0x10, 0x17, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x11, 0x15,
+		0x10, 0x16, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17
+	},
+	{ /* last bit 0, 5 equal bits */
+		0x22, 0x25, 0x20, 0x26, 0x21, 0x25, 0x20, 0x28, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x19,
+		0x14, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x21, 0x25,
+		0x20, 0x26, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x19,
+		0x14, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x22, 0x25, 0x20, 0x26,
+		0x21, 0x25, 0x20, 0x27, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x19,
+		0x14, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x21, 0x25,
+		0x20, 0x26, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x19,
+		0x14, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x24, 0x25, 0x20, 0x26, 0x21, 0x25, 0x20, 0x27, 0x22, 0x25, 0x20, 0x26, 0x21, 0x25, 0x20, 0x28
+	},
+	{ /* last bit 1, 1 equal bits */
+		0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x11, 0x15,
+		0x10, 0x16, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x12, 0x15, 0x10, 0x16,
+		0x11, 0x15, 0x10, 0x17, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x11, 0x15,
+		0x10, 0x16, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x14, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18
+	},
+	{ /* last bit 1, 2 equal bits */
+		0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x11, 0x15,
+		0x10, 0x16, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x12, 0x15, 0x10, 0x16,
+		0x11, 0x15, 0x10, 0x17, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x11, 0x15,
+		0x10, 0x16, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x20, 0x26, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x19
+	},
+	{ /* last bit 1, 3 equal bits */
+		0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x11, 0x15,
+		0x10, 0x16, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x12, 0x15, 0x10, 0x16,
+		0x11, 0x15, 0x10, 0x17, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x11, 0x15,
+		0x21, 0x25, 0x20, 0x27, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x19,
+		0x14, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x21, 0x25
+	},
+	{ /* last bit 1, 4 equal bits */
+		0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x11, 0x15,
+		0x10, 0x16, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x09,
+		0x04, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x08,
+		0x03, 0x05, 0x00, 0x06, 0x01, 0x05, 0x00, 0x07, 0x02, 0x05, 0x00, 0x06, 0x12, 0x15, 0x10, 0x16,
+		0x22, 0x25, 0x20, 0x26, 0x21, 0x25, 0x20, 0x28, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x19,
+		0x14, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x21, 0x25,
+		0x20, 0x26, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x19,
+		0x14, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x22, 0x25, 0x20, 0x26
+	},
+	{ /* last bit 1, 5 equal bits */
+		0x23, 0x25, 0x20, 0x26, 0x21, 0x25, 0x20, 0x27, 0x22, 0x25, 0x20, 0x26, 0x21, 0x25, 0x20, 0x29,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x19,
+		0x14, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x21, 0x25,
+		0x20, 0x26, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x19,
+		0x14, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x22, 0x25, 0x20, 0x26,
+		0x21, 0x25, 0x20, 0x27, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x19,
+		0x14, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x21, 0x25,
+		0x20, 0x26, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x19,
+		0x14, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x12, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x18,
+		0x13, 0x15, 0x10, 0x16, 0x11, 0x15, 0x10, 0x17, 0x23, 0x25, 0x20, 0x26, 0x21, 0x25, 0x20, 0x27
+	}
+};
+
 /**
- * Update the crc value with new data.
+ * Prepare the bit stuffing for a bitmap with SOF at bit 'start'.
  *
- * \param crc      The current crc value.
- * \param data     Data value
- * \param bits	   The number of most significant bits in data used for CRC calculation
- * \return         The updated crc value.
- *****************************************************************************/
-static crc_t crc_update_bitwise(crc_t crc, uint8_t data, size_t bits)
+ * The unused bits in front of SOF are filled with alternating bits ending
+ * with a recessive bit - like the idle bus they do not add stuff bits - so
+ * that the stuffing can start at the byte boundary. Returns the stuffing
+ * state for bit 0.
+ */
+static unsigned stuff_start(uint8_t *bitmap, unsigned start)
 {
-	uint8_t i;
-	bool bit;
-
-	for (i = 0x80; bits--; i >>= 1) {
-		bit = crc & 0x4000;
-		if (data & i) {
-			bit = !bit;
-		}
-		crc <<= 1;
-		if (bit) {
-			crc ^= 0x4599;
-		}
-	}
-	return crc & 0x7fff;
+	bitmap[0] |= ((start & 1) ? 0xaa : 0x55) & ~(0xff >> start);
+	return STUFF_STATE(!(start & 1), 1);
 }
 
-static crc_t calc_bitmap_crc(uint8_t *bitmap, unsigned start, unsigned end)
+/**
+ * Count the stuff bits inserted in front of the bits start..end-1 in the
+ * bitmap and update the stuffing state.
+ */
+static unsigned count_stuffed(const uint8_t *bitmap, unsigned start, unsigned end,
+			      unsigned *state)
 {
-	crc_t crc = 0;
+	unsigned st = *state;
+	unsigned i = start;
+	unsigned stuffed = 0;
+	uint8_t next;
+
+	/* single bits up to the next byte boundary */
+	for (; i < end && i % 8; i++) {
+		next = stuff_bit_table[st][(bitmap[i / 8] >> (7 - i % 8)) & 1];
+		st = next & 0xf;
+		stuffed += next >> 4;
+	}
 
-	if (start % 8) {
-		crc = crc_update_bitwise(crc, bitmap[start / 8] << (start % 8), 8 - start % 8);
-		start += 8 - start % 8;
+	for (; i + 8 <= end; i += 8) {
+		next = stuff_table[st][bitmap[i / 8]];
+		st = next & 0xf;
+		stuffed += next >> 4;
 	}
-	crc = crc_update_bytewise(crc, &bitmap[start / 8], (end - start) / 8);
-	crc = crc_update_bitwise(crc, bitmap[end / 8], end % 8);
-	return crc;
+
+	for (; i < end; i++) {
+		next = stuff_bit_table[st][(bitmap[i / 8] >> (7 - i % 8)) & 1];
+		st = next & 0xf;
+		stuffed += next >> 4;
+	}
+
+	*state = st;
+	return stuffed;
 }
 
 static unsigned cfl_exact(struct can_frame *frame)
@@ -157,10 +378,8 @@ static unsigned cfl_exact(struct can_frame *frame)
 	unsigned start = 0, end;
 	crc_t crc;
 	uint16_t crc_be;
-	uint8_t mask, lookfor;
-	unsigned i, stuffed;
-	const int8_t clz[32] = /* count of leading zeros in 5 bit numbers */
-		{ 5, 4, 3, 3, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+	unsigned stuffed;
+	unsigned state;
 
 	/* Prepare bitmap */
 	memset(bitmap, 0, sizeof(bitmap));
@@ -201,47 +420,198 @@ static unsigned cfl_exact(struct can_frame *frame)
 		end = 24 + 8 * frame->can_dlc;
 	}
 
-	/* Calc and append CRC */
-	crc = calc_bitmap_crc(bitmap, start, end);
-	crc_be = htons(crc << 1);
+	/*
+	 * Calc and append CRC - the zero bits in front of SOF do not change
+	 * the initial CRC value
+	 */
 	assert(end % 8 == 0);
+	crc = crc_update_bytewise(0, bitmap, end / 8);
+	crc_be = htons(crc << 1 | 1); /* CRC del */
 	memcpy(bitmap + end / 8, &crc_be, 2);
+
+	/*
+	 * Count stuffed bits - the stuffing continues up to the CRC delimiter.
+	 * A stuff bit behind the CRC is counted with the CRC delimiter.
+	 */
+	state = stuff_start(bitmap, start);
+	stuffed = count_stuffed(bitmap, 0, end + 16, &state);
 	end += 15;
 
-	/* Count stuffed bits */
-	mask 	= 0x1f;
-	lookfor = 0;
-	i 	= start;
-	stuffed = 0;
-	while (i < end) {
-		unsigned change;
-		unsigned bits = (bitmap[i / 8] << 8 | bitmap[i / 8 + 1]) >> (16 - 5 - i % 8);
-		lookfor = lookfor ? 0 : mask; /* We alternate between looking for a series of zeros or ones */
-		change = (bits & mask) ^ lookfor; /* 1 indicates a change */
-		if (change) { /* No bit was stuffed here */
-			i += clz[change];
-			mask = 0x1f; /* Next look for 5 same bits */
-		} else {
-			i += (mask == 0x1f) ? 5 : 4;
-			if (i <= end) {
-				stuffed++;
-				mask = 0x1e; /* Next look for 4 bits (5th bit is the stuffed one) */
-			}
-		}
-	}
 	return end - start + stuffed +
 		3 + 		/* CRC del, ACK, ACK del */
 		7 +		/* EOF */
 		3;		/* IFS */
 }
 
+/*
+ * CAN FD frames (ISO 11898-1:2015)
+ *
+ * The arbitration phase (nominal bitrate) contains the bits from SOF up to
+ * BRS and the bits from the ACK slot to the end of the IFS. The data phase
+ * contains ESI, DLC, data, stuff count and CRC up to the CRC delimiter.
+ * With CANFD_BRS the data phase uses the data bitrate.
+ *
+ * Dynamic stuff bits are only inserted from SOF to the end of the data
+ * field. The stuff count (3 bit gray code + parity) and the CRC field use
+ * fixed stuff bits: one before the stuff count and then after every 4 bits.
+ * The CRC is CRC17 for up to 16 data bytes and CRC21 above. As the fixed
+ * stuff bits do not depend on the bit values, the CRC value itself has no
+ * influence on the frame length and does not need to be calculated.
+ */
+
+#define CANFD_ARB_SFF 17 /* SOF, ID (11), RRS, IDE, FDF, res, BRS */
+#define CANFD_ARB_EFF 36 /* SOF, ID (11), SRR, IDE, ID (18), RRS, FDF, res, BRS */
+#define CANFD_CTRL 5 /* ESI, DLC (4) in the data phase */
+#define CANFD_SBC 4 /* stuff count */
+#define CANFD_TAIL 12 /* ACK slot, ACK del, EOF (7), IFS (3) */
+
+static uint8_t canfd_len2dlc(uint8_t len)
+{
+	if (len <= 8)
+		return len;
+	if (len <= 12)
+		return 9;
+	if (len <= 16)
+		return 10;
+	if (len <= 20)
+		return 11;
+	if (len <= 24)
+		return 12;
+	if (len <= 32)
+		return 13;
+	if (len <= 48)
+		return 14;
+	return 15;
+}
+
+static uint8_t canfd_dlc2len(uint8_t dlc)
+{
+	static const uint8_t len[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64 };
+
+	return len[dlc & 0xf];
+}
+
+/* data phase bits behind the data field: stuff count, CRC and fixed stuff bits */
+static unsigned canfd_crc_field(unsigned len)
+{
+	unsigned crc = (len > 16) ? 21 : 17;
+
+	return CANFD_SBC + crc + (CANFD_SBC + crc + 3) / 4 + /* fixed stuff bits */
+		1; /* CRC del */
+}
+
+/* returns the arbitration phase bits and the data phase bits in 'data' */
+static unsigned cfl_fd(struct canfd_frame *frame, enum cfl_mode mode, unsigned *data)
+{
+	int eff = (frame->can_id & CAN_EFF_FLAG);
+	uint8_t dlc = canfd_len2dlc(frame->len);
+	unsigned len = canfd_dlc2len(dlc); /* including padding bytes */
+	unsigned copy = (frame->len < len) ? frame->len : len;
+	unsigned arb = eff ? CANFD_ARB_EFF : CANFD_ARB_SFF;
+	unsigned ctrl = arb + CANFD_CTRL; /* bits in front of the data field */
+	unsigned stuffed, arb_stuffed;
+	uint8_t bitmap[80];
+	unsigned start;
+	unsigned state;
+
+	*data = CANFD_CTRL + 8 * len + canfd_crc_field(len);
+
+	switch (mode) {
+	case CFL_NO_BITSTUFFING:
+		/* fixed stuff bits are part of the frame format */
+		return arb + CANFD_TAIL;
+
+	case CFL_WORSTCASE:
+		/*
+		 * a stuff bit after every 4 bits following the first 5 bits -
+		 * but not after the last data bit (fixed stuff bit position)
+		 */
+		stuffed = (ctrl + 8 * len - 2) / 4;
+		arb_stuffed = (arb - 2) / 4;
+		*data += stuffed - arb_stuffed;
+		return arb + arb_stuffed + CANFD_TAIL;
+
+	case CFL_EXACT:
+		break;
+
+	default:
+		*data = 0;
+		return 0; /* Unknown mode */
+	}
+
+	memset(bitmap, 0, sizeof(bitmap));
+	if (eff) {
+		/* bit            7      0 7      0 7      0 7      0
+		 * bitmap[0-3]   |.......s BBBBBBBB BBBSIEEE EEEEEEEE| s = SOF, B = Base ID (11 bits), S = SRR, I = IDE, E = Extended ID (18 bits)
+		 * bitmap[4-7]   |EEEEEEER FrBeDLC4 ........ ........| R = RRS, F = FDF, r = res, B = BRS, e = ESI, DLC4 = DLC, Data bytes
+		 */
+		bitmap[1] = (frame->can_id >> 21) & 0xff;
+		bitmap[2] = ((frame->can_id >> 18) & 0x7) << 5 |
+			    3 << 3 | /* SRR, IDE */
+			    ((frame->can_id >> 15) & 0x7);
+		bitmap[3] = (frame->can_id >> 7) & 0xff;
+		bitmap[4] = (frame->can_id & 0x7f) << 1; /* RRS */
+		bitmap[5] = 1 << 7 | /* FDF, res */
+			    (!!(frame->flags & CANFD_BRS)) << 5 |
+			    (!!(frame->flags & CANFD_ESI)) << 4 |
+			    dlc;
+		memcpy(&bitmap[6], frame->data, copy);
+		start = 7;
+	} else {
+		/* bit           7      0 7      0 7      0 7      0
+		 * bitmap[0-3]  |..sIIIII IIIIIIRE FrBeDLC4 ........| s = SOF, I = ID (11 bits), R = RRS, E = IDE, F = FDF, r = res, B = BRS, e = ESI, DLC4 = DLC, Data bytes
+		 */
+		bitmap[0] = (frame->can_id >> 6) & 0x1f;
+		bitmap[1] = (frame->can_id & 0x3f) << 2; /* RRS, IDE */
+		bitmap[2] = 1 << 7 | /* FDF, res */
+			    (!!(frame->flags & CANFD_BRS)) << 5 |
+			    (!!(frame->flags & CANFD_ESI)) << 4 |
+			    dlc;
+		memcpy(&bitmap[3], frame->data, copy);
+		start = 2;
+	}
+
+	/*
+	 * a stuff bit after BRS is already sent in the data phase - a stuff
+	 * bit after the last data bit is replaced by the fixed stuff bit
+	 */
+	state = stuff_start(bitmap, start);
+	arb_stuffed = count_stuffed(bitmap, 0, start + arb, &state);
+	*data += count_stuffed(bitmap, start + arb, start + ctrl + 8 * len, &state);
+
+	return arb + arb_stuffed + CANFD_TAIL;
+}
+
+unsigned can_frame_length_phases(struct canfd_frame *frame, enum cfl_mode mode,
+				 int mtu, unsigned *data_bits)
+{
+	unsigned arb, data;
+
+	*data_bits = 0;
+
+	if (mtu != CANFD_MTU)
+		return can_frame_length(frame, mode, mtu);
+
+	arb = cfl_fd(frame, mode, &data);
+
+	/* without bitrate switch all bits use the nominal bitrate */
+	if (!(frame->flags & CANFD_BRS))
+		return arb + data;
+
+	*data_bits = data;
+	return arb;
+}
 
 unsigned can_frame_length(struct canfd_frame *frame, enum cfl_mode mode, int mtu)
 {
 	int eff = (frame->can_id & CAN_EFF_FLAG);
+	unsigned data;
+
+	if (mtu == CANFD_MTU)
+		return cfl_fd(frame, mode, &data) + data;
 
 	if (mtu != CAN_MTU)
-		return 0;	/* CANFD is not supported yet */
+		return 0;
 
 	switch (mode) {
 	case CFL_NO_BITSTUFFING:
@@ -253,3 +623,19 @@ unsigned can_frame_length(struct canfd_frame *frame, enum cfl_mode mode, int mtu
 	}
 	return 0; /* Unknown mode */
 }
+
+unsigned long can_frames_length(struct canfd_frame *frames, const int *mtu,
+				unsigned n, enum cfl_mode mode, unsigned *len)
+{
+	unsigned long sum = 0;
+	unsigned i, l;
+
+	for (i = 0; i < n; i++) {
+		l = can_frame_length(&frames[i], mode, mtu[i]);
+		if (len)
+			len[i] = l;
+		sum += l;
+	}
+
+	return sum;
+}
@@ -77,8 +77,30 @@ enum cfl_mode {
  * Calculates the number of bits a frame needs on the wire (including
  * inter frame space).
  *
- * Mode determines how to deal with stuffed bits.
+ * Mode determines how to deal with stuffed bits. CAN FD frames (mtu
+ * CANFD_MTU) contain the bits of both bitrate phases. The fixed stuff
+ * bits of the CAN FD CRC field are counted in all modes.
  */
 unsigned can_frame_length(struct canfd_frame *frame, enum cfl_mode mode, int mtu);
 
+/**
+ * Like can_frame_length() but split into the bitrate phases.
+ *
+ * Returns the number of bits with the nominal (arbitration) bitrate.
+ * The number of bits with the data bitrate is stored in data_bits. It is
+ * only non-zero for CAN FD frames with CANFD_BRS set - without bitrate
+ * switch the whole frame uses the nominal bitrate.
+ */
+unsigned can_frame_length_phases(struct canfd_frame *frame, enum cfl_mode mode,
+				 int mtu, unsigned *data_bits);
+
+/**
+ * Calculates the number of bits of n frames like can_frame_length().
+ *
+ * mtu[i] is the mtu of frames[i]. The length of each frame is stored in
+ * len[i] unless len is NULL. Returns the sum of all frame lengths.
+ */
+unsigned long can_frames_length(struct canfd_frame *frames, const int *mtu,
+				unsigned n, enum cfl_mode mode, unsigned *len);
+
 #endif
@@ -53,6 +53,8 @@
 #include <libgen.h>
 #include <time.h>
 #include <errno.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include <sys/time.h>
 #include <sys/types.h>
@@ -64,23 +66,108 @@
 #include <linux/can.h>
 #include <linux/can/raw.h>
 #include "lib.h"
+#include "canframelen.h"
 
 #define DEFAULT_GAP 200 /* ms */
 #define DEFAULT_BURST_COUNT 1
+#define MAXGEN 64 /* max. number of CAN interfaces */
+#define STATS_POLL 10000000 /* ns - check for finished threads */
+#define MAX_LAG 100000000ULL /* ns - max. catch up after being delayed */
+#define BATCHSZ 64 /* frames per sendmmsg() syscall from the frame pool */
+#define MAX_POOL (1 << 24) /* max. number of frames in the frame pool */
 
 #define MODE_RANDOM	0
 #define MODE_INCREMENT	1
 #define MODE_FIX	2
+#define MODE_SEQ	3
+
+#define SEQ_IDS (1 << 16) /* max. number of CAN IDs with sequence numbers */
 
 extern int optind, opterr, optopt;
 
 static volatile int running = 1;
-static unsigned long long enobufs_count;
+
+/* generator configuration - the same for all CAN interfaces */
+static unsigned long burst_count = DEFAULT_BURST_COUNT;
+static unsigned long polltimeout = 0;
+static unsigned char ignore_enobufs = 0;
+static unsigned char extended = 0;
+static unsigned char canfd = 0;
+static unsigned char brs = 0;
+static unsigned char esi = 0;
+static unsigned char mix = 0;
+static unsigned char id_mode = MODE_RANDOM;
+static unsigned char data_mode = MODE_RANDOM;
+static unsigned char dlc_mode = MODE_RANDOM;
+static unsigned char loopback_disable = 0;
+static unsigned char verbose = 0;
+static unsigned char rtr_frame = 0;
+static int count = 0;
+static unsigned int pool_size = 0; /* pregenerated frames per interface */
+static struct canfd_frame fixframe; /* fix CAN ID and length */
+static unsigned char fixdata[CANFD_MAX_DLEN];
+
+/* next sequence number of a CAN ID */
+struct seqid {
+	canid_t id;
+	uint32_t seq;
+	int used;
+};
+
+/* one sender thread per CAN interface */
+struct gen {
+	char ifname[IFNAMSIZ];
+	double gap;			/* ms */
+	int cpu;			/* CPU affinity (-1 = not set) */
+	unsigned long bitrate;		/* bit/s for the bus load calculation */
+	unsigned long dbitrate;		/* CAN FD data phase bit/s (with BRS) */
+	double rate;			/* target frames/s (0 = use gap) */
+	double load;			/* target bus load in percent (0 = use gap) */
+
+	int s;
+	pthread_t thread;
+	double ns_per_bit;		/* time for one bit at the target load */
+	int done;
+	int err;
+
+	/* frame generator state */
+	uint64_t rnd;			/* xorshift64* state */
+	struct canfd_frame frame;
+	unsigned char extended;
+	unsigned char canfd;
+	unsigned char brs;
+	unsigned char esi;
+	unsigned char rtr_frame;
+	uint64_t incdata;
+	int incdlc;
+
+	/* sequence numbers per CAN ID for -D s (open addressing) */
+	struct seqid *seq;
+	unsigned int nseq;
+
+	/* frame pool for -P */
+	struct canfd_frame *pool;
+	struct iovec *pool_iov;
+	struct mmsghdr *pool_msg;
+	unsigned int *pool_bits;
+
+	/* statistics - only written by the sender thread */
+	unsigned long long frames;
+	unsigned long long bits;
+	unsigned long long enobufs_count;
+
+	/* values at the last statistics output */
+	unsigned long long last_frames;
+	unsigned long long last_bits;
+};
+
+static struct gen gen[MAXGEN];
+static int ngen;
 
 void print_usage(char *prg)
 {
 	fprintf(stderr, "%s - CAN frames generator.\n\n", prg);
-	fprintf(stderr, "Usage: %s [options] <CAN interface>\n", prg);
+	fprintf(stderr, "Usage: %s [options] <CAN interface>+\n", prg);
 	fprintf(stderr, "Options:\n");
 	fprintf(stderr, "         -g <ms>       (gap in milli seconds "
 		"- default: %d ms)\n", DEFAULT_GAP);
@@ -109,14 +196,39 @@ void print_usage(char *prg)
 		"generated CAN frames)\n");
 	fprintf(stderr, "         -c            (number of messages to send in burst, "
 		"default 1)\n");
+	fprintf(stderr, "         -r <rate>     (send <rate> frames per second "
+		"instead of using a gap)\n");
+	fprintf(stderr, "         -l <load>     (generate <load> percent bus load "
+		"instead of using a gap)\n");
+	fprintf(stderr, "         -B <bitrate>  (bitrate of the CAN interfaces "
+		"for the bus load (-l) and statistics\n                        "
+		"- append ',<dbitrate>' for the CAN FD data phase)\n");
+	fprintf(stderr, "         -S            (print statistics every second "
+		"and on exit - implied by -r and -l)\n");
+	fprintf(stderr, "         -P <frames>   (pregenerate a pool of <frames> "
+		"frames and send them with sendmmsg())\n");
+	fprintf(stderr, "         -s <seed>     (seed for the random values "
+		"to repeat a run - default from time)\n");
 	fprintf(stderr, "         -v            (increment verbose level for "
 		"printing sent CAN frames)\n\n");
+	fprintf(stderr, "CAN interface:\n");
+	fprintf(stderr, " <ifname>[:g=<ms>][:r=<rate>][:load=<load>][:cpu=<n>][:bitrate=<bitrate>[,<dbitrate>]]\n");
+	fprintf(stderr, " Each CAN interface is served by its own thread. The "
+		"gap, rate, load and bitrate\n options can be set per interface and the "
+		"thread can be bound to a CPU.\n");
+	fprintf(stderr, " For -r and -l the frames are sent at absolute deadlines. "
+		"The bus load is\n calculated with the exact (bit stuffed) "
+		"length of the generated CAN frames.\n\n");
 	fprintf(stderr, "Generation modes:\n");
 	fprintf(stderr, " 'r'         => random values (default)\n");
 	fprintf(stderr, " 'i'         => increment values\n");
+	fprintf(stderr, " 's'         => sequence number and TX timestamp "
+		"(-D only - see canlatency)\n");
 	fprintf(stderr, " <hexvalue>  => fix value using <hexvalue>\n\n");
 	fprintf(stderr, "When incrementing the CAN data the data length code "
 		"minimum is set to 1.\n");
+	fprintf(stderr, "The sequence number mode needs a data length of "
+		"at least 8 bytes.\n");
 	fprintf(stderr, "CAN IDs and data content are given and expected in hexadecimal values.\n\n");
 	fprintf(stderr, "Examples:\n");
 	fprintf(stderr, "%s vcan0 -g 4 -I 42A -L 1 -D i -v -v\n", prg);
@@ -129,6 +241,14 @@ void print_usage(char *prg)
 	fprintf(stderr, "\t(full load test ignoring -ENOBUFS)\n");
 	fprintf(stderr, "%s vcan0 -g 0 -p 10 -x\n", prg);
 	fprintf(stderr, "\t(full load test with polling, 10ms timeout)\n");
+	fprintf(stderr, "%s -g 0 -i -S can0:cpu=1 can1:cpu=2 can2:g=1:cpu=3\n", prg);
+	fprintf(stderr, "\t(load three interfaces from threads on different CPUs)\n");
+	fprintf(stderr, "%s -g 0 -i -P 100000 -s 42 vcan0 vcan1\n", prg);
+	fprintf(stderr, "\t(max. rate test from a frame pool with repeatable content)\n");
+	fprintf(stderr, "%s -g 1 -I i -D s vcan0\n", prg);
+	fprintf(stderr, "\t(frames for a latency and loss measurement with canlatency)\n");
+	fprintf(stderr, "%s -l 65 -B 500000 -p 10 can0\n", prg);
+	fprintf(stderr, "\t(65%% bus load on a 500 kbit/s CAN bus)\n");
 	fprintf(stderr, "%s vcan0\n", prg);
 	fprintf(stderr, "\t(my favourite default :)\n\n");
 }
@@ -138,53 +258,734 @@ void sigterm(int signo)
 	running = 0;
 }
 
-int main(int argc, char **argv)
+static unsigned long long now_ns(void)
 {
-	double gap = DEFAULT_GAP;
-	unsigned long burst_count = DEFAULT_BURST_COUNT;
-	unsigned long polltimeout = 0;
-	unsigned char ignore_enobufs = 0;
-	unsigned char extended = 0;
-	unsigned char canfd = 0;
-	unsigned char brs = 0;
-	unsigned char esi = 0;
-	unsigned char mix = 0;
-	unsigned char id_mode = MODE_RANDOM;
-	unsigned char data_mode = MODE_RANDOM;
-	unsigned char dlc_mode = MODE_RANDOM;
-	unsigned char loopback_disable = 0;
-	unsigned char verbose = 0;
-	unsigned char rtr_frame = 0;
-	int count = 0;
-	unsigned long burst_sent_count = 0;
-	int mtu, maxdlen;
-	uint64_t incdata = 0;
-	int incdlc = 0;
-	unsigned long rnd;
-	unsigned char fixdata[CANFD_MAX_DLEN];
+	struct timespec ts;
 
-	int opt;
-	int s; /* socket */
-	struct pollfd fds;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* parse '<bitrate>[,<dbitrate>]' - the data bitrate defaults to the bitrate */
+static void parse_bitrate(char *arg, unsigned long *bitrate, unsigned long *dbitrate)
+{
+	char *end;
+
+	*bitrate = strtoul(arg, &end, 10);
+	if (*end == ',')
+		*dbitrate = strtoul(end + 1, NULL, 10);
+	else
+		*dbitrate = *bitrate;
+}
 
+/* parse '<ifname>[:g=<ms>][:r=<rate>][:load=<load>][:cpu=<n>][:bitrate=<bitrate>[,<dbitrate>]]' */
+static int parse_gen(struct gen *g, char *arg, double gap, unsigned long bitrate,
+		     unsigned long dbitrate, double rate, double load)
+{
+	char *opt = strchr(arg, ':');
+
+	if (opt)
+		*opt++ = 0;
+
+	if (strlen(arg) >= IFNAMSIZ) {
+		printf("Name of CAN device '%s' is too long!\n\n", arg);
+		return 1;
+	}
+	strcpy(g->ifname, arg);
+	g->gap = gap;
+	g->cpu = -1;
+	g->bitrate = bitrate;
+	g->dbitrate = dbitrate;
+	g->rate = rate;
+	g->load = load;
+
+	while (opt) {
+		arg = opt;
+		opt = strchr(arg, ':');
+		if (opt)
+			*opt++ = 0;
+
+		if (!strncmp(arg, "g=", 2)) {
+			g->gap = strtod(arg + 2, NULL);
+		} else if (!strncmp(arg, "r=", 2)) {
+			/* overrides a global bus load */
+			g->rate = strtod(arg + 2, NULL);
+			g->load = 0;
+		} else if (!strncmp(arg, "load=", 5)) {
+			/* overrides a global rate */
+			g->load = strtod(arg + 5, NULL);
+			g->rate = 0;
+		} else if (!strncmp(arg, "cpu=", 4)) {
+			g->cpu = atoi(arg + 4);
+		} else if (!strncmp(arg, "bitrate=", 8)) {
+			parse_bitrate(arg + 8, &g->bitrate, &g->dbitrate);
+		} else {
+			printf("Unknown option '%s' for CAN device '%s'!\n\n",
+			       arg, g->ifname);
+			return 1;
+		}
+	}
+
+	if (g->load && g->rate) {
+		printf("Use either a rate or a bus load for CAN device '%s'!\n\n", g->ifname);
+		return 1;
+	}
+
+	if (g->load < 0 || g->load > 100 || g->rate < 0) {
+		printf("Invalid rate or load for CAN device '%s'!\n\n", g->ifname);
+		return 1;
+	}
+
+	if (g->load && !g->bitrate) {
+		printf("The bus load for CAN device '%s' needs a bitrate!\n\n", g->ifname);
+		return 1;
+	}
+
+	if (g->bitrate && !g->dbitrate) {
+		printf("Invalid data bitrate for CAN device '%s'!\n\n", g->ifname);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int open_gen(struct gen *g)
+{
 	struct sockaddr_can addr;
-	static struct canfd_frame frame;
+	struct ifreq ifr;
+
+	if ((g->s = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
+		perror("socket");
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+
+	strcpy(ifr.ifr_name, g->ifname);
+	if (ioctl(g->s, SIOCGIFINDEX, &ifr) < 0) {
+		perror("SIOCGIFINDEX");
+		return 1;
+	}
+	addr.can_ifindex = ifr.ifr_ifindex;
+
+	/* disable default receive filter on this RAW socket */
+	/* This is obsolete as we do not read from the socket at all, but for */
+	/* this reason we can remove the receive list in the Kernel to save a */
+	/* little (really a very little!) CPU usage.                          */
+	setsockopt(g->s, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
+
+	if (loopback_disable) {
+		int loopback = 0;
+
+		setsockopt(g->s, SOL_CAN_RAW, CAN_RAW_LOOPBACK,
+			   &loopback, sizeof(loopback));
+	}
+
+	if (canfd) {
+		int enable_canfd = 1;
+
+		/* check if the frame fits into the CAN netdevice */
+		if (ioctl(g->s, SIOCGIFMTU, &ifr) < 0) {
+			perror("SIOCGIFMTU");
+			return 1;
+		}
+
+		if (ifr.ifr_mtu != CANFD_MTU) {
+			printf("CAN interface %s is not CAN FD capable - sorry.\n", g->ifname);
+			return 1;
+		}
+
+		/* interface is ok - try to switch the socket into CAN FD mode */
+		if (setsockopt(g->s, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable_canfd, sizeof(enable_canfd))){
+			printf("error when enabling CAN FD support\n");
+			return 1;
+		}
+	}
+
+	if (bind(g->s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* xorshift64* - fast and reproducible with a given seed (-s) */
+static inline uint64_t rnd64(struct gen *g)
+{
+	uint64_t x = g->rnd;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	g->rnd = x;
+
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* splitmix64 - different PRNG states for each interface from one seed */
+static uint64_t seed_state(uint64_t seed, int idx)
+{
+	uint64_t z = seed + (idx + 1) * 0x9E3779B97F4A7C15ULL;
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z ^= z >> 31;
+
+	return (z)?z:1; /* xorshift state must not be zero */
+}
+
+/* return the next sequence number for the CAN ID - or -1 when the table is full */
+static int64_t next_seq(struct gen *g, canid_t id)
+{
+	unsigned int h = (id * 0x9E3779B1U) >> 16;
+	struct seqid *e;
+
+	for (;; h = (h + 1) & (SEQ_IDS - 1)) {
+		e = &g->seq[h];
+
+		if (e->used && e->id == id)
+			return e->seq++;
+
+		if (!e->used)
+			break;
+	}
+
+	/* keep the table sparse for short probe sequences */
+	if (g->nseq >= SEQ_IDS / 4 * 3)
+		return -1;
+
+	g->nseq++;
+	e->used = 1;
+	e->id = id;
+	e->seq = 1;
+
+	return 0;
+}
+
+/*
+ * Payload for -D s (little endian) - evaluated by canlatency:
+ * data[0..3]: sequence number per CAN ID
+ * data[4..7]: lower 32 bit of the CLOCK_MONOTONIC TX time in ns
+ */
+static int put_seq(struct gen *g, struct canfd_frame *frame)
+{
+	int64_t seq = next_seq(g, frame->can_id);
+	uint32_t ts;
+	int i;
+
+	if (seq < 0)
+		return 1;
+
+	ts = (uint32_t)now_ns();
+	for (i = 0; i < 4; i++) {
+		frame->data[i] = (seq >> i*8) & 0xFF;
+		frame->data[4 + i] = (ts >> i*8) & 0xFF;
+	}
+
+	return 0;
+}
+
+/* create the next CAN frame in g->frame and return its mtu (-1 on error) */
+static int gen_frame(struct gen *g)
+{
+	struct canfd_frame *frame = &g->frame;
+	uint64_t rnd;
+	int mtu, maxdlen;
+	int i;
+
+	frame->flags = 0;
+
+	if (g->canfd) {
+		mtu = CANFD_MTU;
+		maxdlen = CANFD_MAX_DLEN;
+		if (g->brs)
+			frame->flags |= CANFD_BRS;
+		if (g->esi)
+			frame->flags |= CANFD_ESI;
+	} else {
+		mtu = CAN_MTU;
+		maxdlen = CAN_MAX_DLEN;
+	}
+
+	if (id_mode == MODE_RANDOM)
+		frame->can_id = rnd64(g) >> 32;
+
+	if (g->extended) {
+		frame->can_id &= CAN_EFF_MASK;
+		frame->can_id |= CAN_EFF_FLAG;
+	} else
+		frame->can_id &= CAN_SFF_MASK;
+
+	if (g->rtr_frame && !g->canfd)
+		frame->can_id |= CAN_RTR_FLAG;
+
+	if (dlc_mode == MODE_RANDOM) {
+
+		if (g->canfd)
+			frame->len = can_dlc2len((rnd64(g) >> 32) & 0xF);
+		else {
+			frame->len = (rnd64(g) >> 32) & 0xF;
+			if (frame->len & 8)
+				frame->len = 8; /* for about 50% of the frames */
+		}
+	}
+
+	if (data_mode == MODE_INCREMENT && !frame->len)
+		frame->len = 1; /* min dlc value for incr. data */
+
+	if (data_mode == MODE_SEQ && frame->len < 8)
+		frame->len = 8; /* sequence number and timestamp */
+
+	if (data_mode == MODE_RANDOM) {
+		/* one PRNG step for 8 bytes of the payload */
+		for (i = 0; i < frame->len; i += 8) {
+			rnd = rnd64(g);
+			memcpy(&frame->data[i], &rnd, 8);
+		}
+	}
+
+	if (data_mode == MODE_FIX)
+		memcpy(frame->data, fixdata, CANFD_MAX_DLEN);
+
+	/* RTR frames have no payload - and no sequence number */
+	if (data_mode == MODE_SEQ && !(frame->can_id & CAN_RTR_FLAG)) {
+		if (put_seq(g, frame))
+			return -1;
+	}
+
+	/* set unused payload data to zero like the CAN driver does it on rx */
+	if (frame->len < maxdlen)
+		memset(&frame->data[frame->len], 0, maxdlen - frame->len);
+
+	return mtu;
+}
+
+/* update the incremented values and the frame type for the next frame */
+static void next_frame(struct gen *g)
+{
+	struct canfd_frame *frame = &g->frame;
+	int i;
+
+	if (id_mode == MODE_INCREMENT)
+		frame->can_id++;
+
+	if (dlc_mode == MODE_INCREMENT) {
+
+		g->incdlc++;
+
+		if (g->canfd && !mix) {
+			g->incdlc &= 0xF;
+			frame->len = can_dlc2len(g->incdlc);
+		} else {
+			g->incdlc %= 9;
+			frame->len = g->incdlc;
+		}
+	}
+
+	if (data_mode == MODE_INCREMENT) {
+
+		g->incdata++;
+
+		for (i=0; i<8 ;i++)
+			frame->data[i] = (g->incdata >> i*8) & 0xFFULL;
+	}
+
+	if (mix) {
+		i = rnd64(g) >> 32;
+		g->extended = i&1;
+		g->canfd = i&2;
+		if (g->canfd) {
+			g->brs = i&4;
+			g->esi = i&8;
+		}
+		g->rtr_frame = ((i&24) == 24); /* reduce RTR frames to 1/4 */
+	}
+}
+
+/* set up the generator state with the global configuration */
+static void init_gen(struct gen *g, uint64_t seed, int idx)
+{
+	g->rnd = seed_state(seed, idx);
+	g->frame = fixframe;
+	g->extended = extended;
+	g->canfd = canfd;
+	g->brs = brs;
+	g->esi = esi;
+	g->rtr_frame = rtr_frame;
+	g->incdata = 0;
+	g->incdlc = 0;
+}
+
+static int alloc_seq(struct gen *g)
+{
+	g->seq = calloc(SEQ_IDS, sizeof(*g->seq));
+	if (!g->seq) {
+		perror("calloc");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* bits of the frame on the bus - data phase bits converted to the bitrate */
+static unsigned int frame_bits(struct gen *g, struct canfd_frame *frame, int mtu)
+{
+	unsigned int data_bits;
+	unsigned int bits = can_frame_length_phases(frame, CFL_EXACT, mtu, &data_bits);
+
+	if (data_bits)
+		bits += (unsigned long long)data_bits * g->bitrate / g->dbitrate;
+
+	return bits;
+}
+
+/* pregenerate the frames for the max-rate transmission with sendmmsg() */
+static int fill_pool(struct gen *g)
+{
+	int mtu;
+	unsigned int i;
+
+	g->pool = malloc(pool_size * sizeof(*g->pool));
+	g->pool_iov = malloc(pool_size * sizeof(*g->pool_iov));
+	g->pool_msg = calloc(pool_size, sizeof(*g->pool_msg));
+	g->pool_bits = malloc(pool_size * sizeof(*g->pool_bits));
+	if (!g->pool || !g->pool_iov || !g->pool_msg || !g->pool_bits) {
+		perror("malloc");
+		return 1;
+	}
+
+	for (i = 0; i < pool_size; i++) {
+		mtu = gen_frame(g);
+		g->pool[i] = g->frame;
+		next_frame(g);
+
+		g->pool_iov[i].iov_base = &g->pool[i];
+		g->pool_iov[i].iov_len = mtu;
+		g->pool_msg[i].msg_hdr.msg_iov = &g->pool_iov[i];
+		g->pool_msg[i].msg_hdr.msg_iovlen = 1;
+
+		/* the bit length is only needed for statistics and bus load */
+		if (g->bitrate)
+			g->pool_bits[i] = frame_bits(g, &g->pool[i], mtu);
+		else
+			g->pool_bits[i] = 0;
+	}
+
+	return 0;
+}
+
+static void print_frame(struct gen *g, struct canfd_frame *frame, int mtu)
+{
+	char buf[CL_LONGCFSZ];
+	int maxdlen = (mtu == CANFD_MTU)?CANFD_MAX_DLEN:CAN_MAX_DLEN;
+
+	/* one printf() to not mix up the output of the threads */
+	if (verbose > 1)
+		sprint_long_canframe(buf, frame, (verbose > 2)?1:0, maxdlen);
+	else
+		sprint_canframe(buf, frame, 1, maxdlen);
+
+	printf("  %s  %s\n", g->ifname, buf);
+}
+
+/* wait for the absolute deadline of the next frame for -r and -l */
+static int wait_deadline(struct gen *g, unsigned long long *deadline,
+			 unsigned int bits, unsigned int frames)
+{
+	struct timespec ts;
+	unsigned long long now;
+
+	/* the next frame is due when the sent frames have left the bus */
+	if (g->load)
+		*deadline += bits * g->ns_per_bit;
+	else
+		*deadline += frames * 1e9 / g->rate;
+
+	now = now_ns();
+	if (now > *deadline + MAX_LAG)
+		*deadline = now; /* do not catch up with long delays */
+
+	if (*deadline <= now)
+		return 0;
+
+	ts.tv_sec = *deadline / 1000000000ULL;
+	ts.tv_nsec = *deadline % 1000000000ULL;
+
+	return clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/* send the frame pool in a loop - returns 1 on error */
+static int send_pool(struct gen *g, struct timespec *ts, struct pollfd *fds)
+{
+	unsigned long long deadline = now_ns();
+	unsigned int batch, idx = 0;
+	unsigned int bits, n, i;
+	int left = count;
+	int ret;
+
+	/* bursts of frames for a given gap or rate - otherwise max. rate */
+	if (g->gap || g->rate || g->load)
+		batch = burst_count;
+	else
+		batch = BATCHSZ;
+
+	if (batch > BATCHSZ)
+		batch = BATCHSZ;
+	if (!batch)
+		batch = 1;
+
+	while (running) {
+		n = batch;
+		if (n > pool_size - idx)
+			n = pool_size - idx;
+		if (count && n > (unsigned int)left)
+			n = left;
+
+		if (verbose) {
+			for (i = idx; i < idx + n; i++)
+				print_frame(g, &g->pool[i], g->pool_iov[i].iov_len);
+		}
+
+		ret = sendmmsg(g->s, &g->pool_msg[idx], n, 0);
+		bits = 0;
+		if (ret < 0) {
+			if (errno != ENOBUFS || (!ignore_enobufs && !polltimeout)) {
+				perror("sendmmsg");
+				return 1;
+			}
+			__atomic_store_n(&g->enobufs_count, g->enobufs_count + 1,
+					 __ATOMIC_RELAXED);
+			if (polltimeout) {
+				/* wait for the write socket (with timeout) */
+				if (poll(fds, 1, polltimeout) < 0) {
+					perror("poll");
+					return 1;
+				}
+				continue;
+			}
+			ret = 1; /* drop the frame like write() does with -i */
+		} else {
+			if (g->bitrate) {
+				for (i = idx; i < idx + ret; i++)
+					bits += g->pool_bits[i];
+				__atomic_store_n(&g->bits, g->bits + bits, __ATOMIC_RELAXED);
+			}
+			__atomic_store_n(&g->frames, g->frames + ret, __ATOMIC_RELAXED);
+		}
+
+		idx += ret;
+		if (idx == pool_size)
+			idx = 0;
+
+		if (count) {
+			left -= ret;
+			if (!left)
+				break;
+		}
+
+		if (g->rate || g->load) {
+			if (wait_deadline(g, &deadline, bits, ret))
+				break;
+		} else if (g->gap) {
+			if (nanosleep(ts, NULL))
+				break;
+		}
+	}
+
+	return 0;
+}
+
+static void *gen_thread(void *arg)
+{
+	struct gen *g = arg;
+	unsigned long burst_sent_count = 0;
+	int count_ = count;
+	int mtu;
+	struct pollfd fds;
+	struct timespec ts;
+	cpu_set_t cpus;
+	unsigned long long deadline = 0;
+	unsigned int bits = 0;
 	int nbytes;
+
+	if (g->cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(g->cpu, &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+			perror("sched_setaffinity");
+			goto error;
+		}
+	}
+
+	ts.tv_sec = g->gap / 1000;
+	ts.tv_nsec = (long)(((long long)(g->gap * 1000000)) % 1000000000ll);
+
+	if (polltimeout) {
+		fds.fd = g->s;
+		fds.events = POLLOUT;
+	}
+
+	/* time on the wire for one bit at the given load */
+	if (g->load)
+		g->ns_per_bit = 1e9 / (g->bitrate * g->load / 100);
+
+	if (g->pool) {
+		if (send_pool(g, &ts, &fds))
+			goto error;
+		goto done;
+	}
+
+	if (g->rate || g->load)
+		deadline = now_ns();
+
+	while (running) {
+
+		if (count_ && (--count_ == 0))
+			g->done = 1;
+
+		mtu = gen_frame(g);
+		if (mtu < 0) {
+			fprintf(stderr, "More than %d CAN IDs with sequence "
+				"numbers on %s!\n", SEQ_IDS / 4 * 3, g->ifname);
+			goto error;
+		}
+
+		if (verbose)
+			print_frame(g, &g->frame, mtu);
+
+resend:
+		bits = 0; /* a dropped frame does not load the bus - see send_pool() */
+		nbytes = write(g->s, &g->frame, mtu);
+		if (nbytes < 0) {
+			if (errno != ENOBUFS) {
+				perror("write");
+				goto error;
+			}
+			if (!ignore_enobufs && !polltimeout) {
+				perror("write");
+				goto error;
+			}
+			if (polltimeout) {
+				__atomic_store_n(&g->enobufs_count, g->enobufs_count + 1,
+						 __ATOMIC_RELAXED);
+				/* wait for the write socket (with timeout) */
+				if (poll(&fds, 1, polltimeout) < 0) {
+					perror("poll");
+					goto error;
+				} else
+					goto resend;
+			} else
+				__atomic_store_n(&g->enobufs_count, g->enobufs_count + 1,
+						 __ATOMIC_RELAXED);
+
+		} else if (nbytes < mtu) {
+			fprintf(stderr, "write: incomplete CAN frame\n");
+			goto error;
+		} else {
+			__atomic_store_n(&g->frames, g->frames + 1, __ATOMIC_RELAXED);
+			if (g->bitrate) {
+				bits = frame_bits(g, &g->frame, mtu);
+				__atomic_store_n(&g->bits, g->bits + bits, __ATOMIC_RELAXED);
+			}
+		}
+
+		if (g->done)
+			break;
+
+		if (g->rate || g->load) {
+			if (wait_deadline(g, &deadline, bits, 1))
+				break;
+		} else {
+			burst_sent_count++;
+			if (g->gap && burst_sent_count >= burst_count) /* gap == 0 => performance test :-] */
+				if (nanosleep(&ts, NULL))
+					break;
+		}
+
+		if (burst_sent_count >= burst_count)
+			burst_sent_count = 0;
+
+		next_frame(g);
+	}
+
+done:
+	__atomic_store_n(&g->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+
+error:
+	g->err = 1;
+	running = 0; /* stop all threads */
+	__atomic_store_n(&g->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/* print frames/s, bus load and ENOBUFS of all interfaces for 'secs' */
+static void print_stats(double secs, int total)
+{
+	unsigned long long frames, bits, sum_frames = 0, sum_bits = 0, enobufs = 0;
+	struct gen *g;
 	int i;
-	struct ifreq ifr;
 
+	for (i = 0; i < ngen; i++) {
+		g = &gen[i];
+		frames = __atomic_load_n(&g->frames, __ATOMIC_RELAXED);
+		bits = __atomic_load_n(&g->bits, __ATOMIC_RELAXED);
+
+		if (!total) {
+			frames -= g->last_frames;
+			bits -= g->last_bits;
+			g->last_frames += frames;
+			g->last_bits += bits;
+		}
+
+		printf("%-*s %10.0f frames/s", IFNAMSIZ, g->ifname, frames / secs);
+		if (g->rate)
+			printf(" (target %.0f)", g->rate);
+		if (g->bitrate)
+			printf(" %6.2f%% bus load", 100.0 * bits / secs / g->bitrate);
+		if (g->load)
+			printf(" (target %.2f%%)", g->load);
+		printf(" %10llu ENOBUFS\n", __atomic_load_n(&g->enobufs_count, __ATOMIC_RELAXED));
+
+		sum_frames += frames;
+		sum_bits += bits;
+		enobufs += __atomic_load_n(&g->enobufs_count, __ATOMIC_RELAXED);
+	}
+
+	if (ngen > 1)
+		printf("%-*s %10.0f frames/s %10llu ENOBUFS\n", IFNAMSIZ, "all",
+		       sum_frames / secs, enobufs);
+
+	fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+	double gap = DEFAULT_GAP;
+	unsigned long bitrate = 0;
+	unsigned long dbitrate = 0;
+	double rate = 0;
+	double load = 0;
+	int stats = 0;
+	uint64_t seed;
+	int opt;
+	int i, err = 0;
+	int active;
+	unsigned long long start, next;
 	struct timespec ts;
 	struct timeval now;
 
 	/* set seed value for pseudo random numbers */
 	gettimeofday(&now, NULL);
-	srandom(now.tv_usec);
+	seed = ((uint64_t)now.tv_sec << 20) ^ now.tv_usec;
 
 	signal(SIGTERM, sigterm);
 	signal(SIGHUP, sigterm);
 	signal(SIGINT, sigterm);
 
-	while ((opt = getopt(argc, argv, "ig:ebEfmI:L:D:xp:n:c:vRh?")) != -1) {
+	while ((opt = getopt(argc, argv, "ig:ebEfmI:L:D:xp:n:c:r:l:B:SP:s:vRh?")) != -1) {
 		switch (opt) {
 
 		case 'i':
@@ -225,7 +1026,7 @@ int main(int argc, char **argv)
 				id_mode = MODE_INCREMENT;
 			} else {
 				id_mode = MODE_FIX;
-				frame.can_id = strtoul(optarg, NULL, 16);
+				fixframe.can_id = strtoul(optarg, NULL, 16);
 			}
 			break;
 
@@ -236,7 +1037,7 @@ int main(int argc, char **argv)
 				dlc_mode = MODE_INCREMENT;
 			} else {
 				dlc_mode = MODE_FIX;
-				frame.len = atoi(optarg) & 0xFF; /* is cut to 8 / 64 later */
+				fixframe.len = atoi(optarg) & 0xFF; /* is cut to 8 / 64 later */
 			}
 			break;
 
@@ -245,6 +1046,8 @@ int main(int argc, char **argv)
 				data_mode = MODE_RANDOM;
 			} else if (optarg[0] == 'i') {
 				data_mode = MODE_INCREMENT;
+			} else if (optarg[0] == 's') {
+				data_mode = MODE_SEQ;
 			} else {
 				data_mode = MODE_FIX;
 				if (hexstring2data(optarg, fixdata, CANFD_MAX_DLEN)) {
@@ -258,6 +1061,34 @@ int main(int argc, char **argv)
 			burst_count = strtoul(optarg, NULL, 10);
 			break;
 
+		case 'r':
+			rate = strtod(optarg, NULL);
+			break;
+
+		case 'l':
+			load = strtod(optarg, NULL);
+			break;
+
+		case 'B':
+			parse_bitrate(optarg, &bitrate, &dbitrate);
+			break;
+
+		case 'S':
+			stats = 1;
+			break;
+
+		case 'P':
+			pool_size = strtoul(optarg, NULL, 10);
+			if (!pool_size || pool_size > MAX_POOL) {
+				print_usage(basename(argv[0]));
+				return 1;
+			}
+			break;
+
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+
 		case 'v':
 			verbose++;
 			break;
@@ -296,237 +1127,111 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	ts.tv_sec = gap / 1000;
-	ts.tv_nsec = (long)(((long long)(gap * 1000000)) % 1000000000ll);
+	if (argc - optind > MAXGEN) {
+		printf("More than %d CAN interfaces are not supported!\n\n", MAXGEN);
+		return 1;
+	}
 
 	/* recognize obviously missing commandline option */
-	if (id_mode == MODE_FIX && frame.can_id > 0x7FF && !extended) {
+	if (id_mode == MODE_FIX && fixframe.can_id > 0x7FF && !extended) {
 		printf("The given CAN-ID is greater than 0x7FF and "
 		       "the '-e' option is not set.\n");
 		return 1;
 	}
 
-	if (strlen(argv[optind]) >= IFNAMSIZ) {
-		printf("Name of CAN device '%s' is too long!\n\n", argv[optind]);
-		return 1;
-	}
-
-	if ((s = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
-		perror("socket");
+	/* the TX timestamp can not be pregenerated */
+	if (data_mode == MODE_SEQ && pool_size) {
+		printf("The sequence number mode can not be used with a frame pool.\n");
 		return 1;
 	}
 
-	addr.can_family = AF_CAN;
-
-	strcpy(ifr.ifr_name, argv[optind]);
-	if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
-		perror("SIOCGIFINDEX");
-		return 1;
-	}
-	addr.can_ifindex = ifr.ifr_ifindex;
-
-	/* disable default receive filter on this RAW socket */
-	/* This is obsolete as we do not read from the socket at all, but for */
-	/* this reason we can remove the receive list in the Kernel to save a */
-	/* little (really a very little!) CPU usage.                          */
-	setsockopt(s, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
-
-	if (loopback_disable) {
-		int loopback = 0;
-
-		setsockopt(s, SOL_CAN_RAW, CAN_RAW_LOOPBACK,
-			   &loopback, sizeof(loopback));
-	}
-
 	if (canfd) {
-		int enable_canfd = 1;
-
-		/* check if the frame fits into the CAN netdevice */
-		if (ioctl(s, SIOCGIFMTU, &ifr) < 0) {
-			perror("SIOCGIFMTU");
-			return 1;
-		}
-
-		if (ifr.ifr_mtu != CANFD_MTU) {
-			printf("CAN interface is not CAN FD capable - sorry.\n");
-			return 1;
-		}
-
-		/* interface is ok - try to switch the socket into CAN FD mode */
-		if (setsockopt(s, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable_canfd, sizeof(enable_canfd))){
-			printf("error when enabling CAN FD support\n");
-			return 1;
-		}
-
 		/* ensure discrete CAN FD length values 0..8, 12, 16, 20, 24, 32, 64 */
-		frame.len = can_dlc2len(can_len2dlc(frame.len));
+		fixframe.len = can_dlc2len(can_len2dlc(fixframe.len));
 	} else {
 		/* sanitize CAN 2.0 frame length */
-		if (frame.len > 8)
-			frame.len = 8;
-	}
-
-	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-		perror("bind");
-		return 1;
-	}
-
-	if (polltimeout) {
-		fds.fd = s;
-		fds.events = POLLOUT;
+		if (fixframe.len > 8)
+			fixframe.len = 8;
 	}
 
-	while (running) {
-		frame.flags = 0;
-
-		if (count && (--count == 0))
-			running = 0;
-
-		if (canfd){
-			mtu = CANFD_MTU;
-			maxdlen = CANFD_MAX_DLEN;
-			if (brs)
-				frame.flags |= CANFD_BRS;
-			if (esi)
-				frame.flags |= CANFD_ESI;
-		} else {
-			mtu = CAN_MTU;
-			maxdlen = CAN_MAX_DLEN;
-		}
-
-		if (id_mode == MODE_RANDOM)
-			frame.can_id = random();
-
-		if (extended) {
-			frame.can_id &= CAN_EFF_MASK;
-			frame.can_id |= CAN_EFF_FLAG;
-		} else
-			frame.can_id &= CAN_SFF_MASK;
-
-		if (rtr_frame && !canfd)
-			frame.can_id |= CAN_RTR_FLAG;
-
-		if (dlc_mode == MODE_RANDOM) {
-
-			if (canfd)
-				frame.len = can_dlc2len(random() & 0xF);
-			else {
-				frame.len = random() & 0xF;
-				if (frame.len & 8)
-					frame.len = 8; /* for about 50% of the frames */
-			}
-		}
-
-		if (data_mode == MODE_INCREMENT && !frame.len)
-			frame.len = 1; /* min dlc value for incr. data */
-
-		if (data_mode == MODE_RANDOM) {
-
-			rnd = random();
-			memcpy(&frame.data[0], &rnd, 4);
-			rnd = random();
-			memcpy(&frame.data[4], &rnd, 4);
-
-			/* omit extra random number generation for CAN FD */
-			if (canfd && frame.len > 8) {
-				memcpy(&frame.data[8], &frame.data[0], 8);
-				memcpy(&frame.data[16], &frame.data[0], 16);
-				memcpy(&frame.data[32], &frame.data[0], 32);
-			}
-		}
-
-		if (data_mode == MODE_FIX)
-			memcpy(frame.data, fixdata, CANFD_MAX_DLEN);
-
-		/* set unused payload data to zero like the CAN driver does it on rx */
-		if (frame.len < maxdlen)
-			memset(&frame.data[frame.len], 0, maxdlen - frame.len);
-
-		if (verbose) {
-
-			printf("  %s  ", argv[optind]);
-
-			if (verbose > 1)
-				fprint_long_canframe(stdout, &frame, "\n", (verbose > 2)?1:0, maxdlen);
-			else
-				fprint_canframe(stdout, &frame, "\n", 1, maxdlen);
-		}
+	for (ngen = 0; optind < argc; optind++, ngen++) {
+		if (parse_gen(&gen[ngen], argv[optind], gap, bitrate, dbitrate, rate, load))
+			return 1;
 
-resend:
-		nbytes = write(s, &frame, mtu);
-		if (nbytes < 0) {
-			if (errno != ENOBUFS) {
-				perror("write");
-				return 1;
-			}
-			if (!ignore_enobufs && !polltimeout) {
-				perror("write");
-				return 1;
-			}
-			if (polltimeout) {
-				/* wait for the write socket (with timeout) */
-				if (poll(&fds, 1, polltimeout) < 0) {
-					perror("poll");
-					return 1;
-				} else
-					goto resend;
-			} else
-				enobufs_count++;
+		/* report the achieved rate / bus load */
+		if (gen[ngen].rate || gen[ngen].load)
+			stats = 1;
 
-		} else if (nbytes < mtu) {
-			fprintf(stderr, "write: incomplete CAN frame\n");
+		if (open_gen(&gen[ngen]))
 			return 1;
-		}
 
-		burst_sent_count++;
-		if (gap && burst_sent_count >= burst_count) /* gap == 0 => performance test :-] */
-			if (nanosleep(&ts, NULL))
-				return 1;
+		/* different random numbers for each interface */
+		init_gen(&gen[ngen], seed, ngen);
 
-		if (burst_sent_count >= burst_count)
-			burst_sent_count = 0;
+		if (data_mode == MODE_SEQ && alloc_seq(&gen[ngen]))
+			return 1;
 
-		if (id_mode == MODE_INCREMENT)
-			frame.can_id++;
+		if (pool_size && fill_pool(&gen[ngen]))
+			return 1;
+	}
 
-		if (dlc_mode == MODE_INCREMENT) {
+	/* the seed allows to repeat the run with the same CAN frames */
+	if (stats || verbose)
+		printf("random seed %llu\n", (unsigned long long)seed);
 
-			incdlc++;
+	start = now_ns();
 
-			if (canfd && !mix) {
-				incdlc &= 0xF;
-				frame.len = can_dlc2len(incdlc);
-			} else {
-				incdlc %= 9;
-				frame.len = incdlc;
-			}
+	for (i = 0; i < ngen; i++) {
+		if (pthread_create(&gen[i].thread, NULL, gen_thread, &gen[i])) {
+			perror("pthread_create");
+			running = 0;
+			ngen = i;
+			err = 1;
+			break;
 		}
+	}
 
-		if (data_mode == MODE_INCREMENT) {
+	/* print the statistics every second until all threads are done */
+	next = start + 1000000000ULL;
+	ts.tv_sec = 0;
+	ts.tv_nsec = STATS_POLL;
+	while (stats && running) {
+		nanosleep(&ts, NULL);
 
-			incdata++;
+		for (active = 0, i = 0; i < ngen; i++)
+			active += !__atomic_load_n(&gen[i].done, __ATOMIC_ACQUIRE);
 
-			for (i=0; i<8 ;i++)
-				frame.data[i] = (incdata >> i*8) & 0xFFULL;
-		}
+		if (!active)
+			break;
 
-		if (mix) {
-			i = random();
-			extended = i&1;
-			canfd = i&2;
-			if (canfd) {
-				brs = i&4;
-				esi = i&8;
-			}
-			rtr_frame = ((i&24) == 24); /* reduce RTR frames to 1/4 */
+		if (now_ns() >= next && running) {
+			print_stats(1.0, 0);
+			next += 1000000000ULL;
 		}
 	}
 
-	if (enobufs_count)
-		printf("\nCounted %llu ENOBUFS return values on write().\n\n",
-		       enobufs_count);
+	for (i = 0; i < ngen; i++) {
+		pthread_join(gen[i].thread, NULL);
+		err |= gen[i].err;
+	}
+
+	if (stats) {
+		printf("\naverage:\n");
+		print_stats((now_ns() - start) / 1e9, 1);
+	}
 
-	close(s);
+	for (i = 0; i < ngen; i++) {
+		if (gen[i].enobufs_count)
+			printf("\nCounted %llu ENOBUFS return values on write() on %s.\n\n",
+			       gen[i].enobufs_count, gen[i].ifname);
+
+		close(gen[i].s);
+		free(gen[i].pool);
+		free(gen[i].pool_iov);
+		free(gen[i].pool_msg);
+		free(gen[i].pool_bits);
+		free(gen[i].seq);
+	}
 
-	return 0;
+	return err;
 }
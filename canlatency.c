@@ -0,0 +1,605 @@
+/* SPDX-License-Identifier: (GPL-2.0-only OR BSD-3-Clause) */
+/*
+ * canlatency.c - measure CAN frame latency, loss, reordering and duplicates
+ *
+ * Evaluates the sequence numbers and TX timestamps of CAN frames that are
+ * generated with 'cangen -D s', e.g. after passing a cangw rule, a CAN
+ * gateway or a physical loop between two CAN interfaces.
+ *
+ * The TX timestamp is the lower 32 bit of CLOCK_MONOTONIC in ns. Therefore
+ * cangen and canlatency have to run on the same host and latencies above
+ * ~4.29 seconds can not be measured.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <libgen.h>
+#include <time.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <net/if.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#define MAXSOCK 16 /* max. number of CAN interfaces given on the cmdline */
+#define ANYDEV "any" /* name of interface to receive from any CAN interface */
+#define BATCHSZ 64 /* max. number of CAN frames per recvmmsg() syscall */
+#define MAXFLOWS (1 << 16) /* max. number of interface/CAN ID combinations */
+#define LATHISTSZ 100000 /* 1us latency histogram buckets (100ms) */
+#define LOGHISTSZ 33 /* log2(ns) latency histogram buckets per CAN ID */
+#define SEQWIN 64 /* sequence numbers checked for duplicates */
+
+#define CTRLMSG_LEN CMSG_SPACE(sizeof(struct timespec))
+
+extern int optind, opterr, optopt;
+
+/* frames of one CAN ID received on one CAN interface */
+struct flow {
+	int ifindex;
+	canid_t id;
+	int used;
+	uint32_t next;			/* expected sequence number */
+	uint64_t win;			/* received sequence numbers before 'next' */
+	unsigned long long rx;
+	unsigned long long lost;
+	unsigned long long reorder;
+	unsigned long long dup;
+	unsigned long long lat_sum;	/* ns */
+	uint32_t lat_min;
+	uint32_t lat_max;
+	unsigned int hist[LOGHISTSZ];
+};
+
+/* latency statistics for the statistics interval and the whole run */
+struct latstat {
+	unsigned long long rx;
+	unsigned long long lost;
+	unsigned long long reorder;
+	unsigned long long dup;
+	unsigned long long sum;		/* ns */
+	uint32_t min;
+	uint32_t max;
+	unsigned long long over;	/* latency >= LATHISTSZ us */
+	unsigned int hist[LATHISTSZ];
+};
+
+static volatile int running = 1;
+static struct flow *flows;
+static unsigned int nflows;
+static unsigned long long untracked;	/* frames without a flow entry */
+static unsigned long long ignored;	/* frames without sequence number */
+static struct latstat total, interval;
+
+void print_usage(char *prg)
+{
+	fprintf(stderr, "%s - measure CAN frame latency, loss, reordering and duplicates.\n", prg);
+	fprintf(stderr, "\nUsage: %s [options] <CAN interface>+\n", prg);
+	fprintf(stderr, "  (use CTRL-C to terminate %s)\n\n", prg);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "         -t <secs>   (statistics interval - default 1s, "
+		"0 = only on exit)\n");
+	fprintf(stderr, "         -n <count>  (terminate after reception of "
+		"<count> CAN frames)\n");
+	fprintf(stderr, "         -s          (omit the statistics per CAN ID on exit)\n");
+	fprintf(stderr, "         -H          (print the latency histogram on exit)\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Up to %d CAN interfaces can be specified. Use '%s' to "
+		"receive from all\nCAN interfaces.\n\n", MAXSOCK, ANYDEV);
+	fprintf(stderr, "The CAN frames have to be generated with 'cangen -D s' "
+		"on the same host.\n");
+	fprintf(stderr, "Sequence numbers are tracked per CAN interface and CAN ID. "
+		"Frames that\narrive after a later sequence number are counted "
+		"as reordered and are\nremoved from the lost frames. A "
+		"sequence number %d or more\nbehind the latest one restarts "
+		"the tracking (e.g. after restarting cangen).\n", SEQWIN);
+	fprintf(stderr, "\nExample:\n");
+	fprintf(stderr, "cangw -A -s vcan0 -d vcan1 -e\n");
+	fprintf(stderr, "%s vcan1 &\n", prg);
+	fprintf(stderr, "cangen -g 1 -I i -D s -n 10000 vcan0\n\n");
+}
+
+void sigterm(int signo)
+{
+	running = 0;
+}
+
+static unsigned long long now_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void init_latstat(struct latstat *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->min = UINT32_MAX;
+}
+
+static struct flow *get_flow(int ifindex, canid_t id)
+{
+	unsigned int h = ((id ^ (ifindex << 24)) * 0x9E3779B1U) >> 16;
+	struct flow *f;
+
+	for (;; h = (h + 1) & (MAXFLOWS - 1)) {
+		f = &flows[h];
+
+		if (f->used && f->id == id && f->ifindex == ifindex)
+			return f;
+
+		if (!f->used)
+			break;
+	}
+
+	/* keep the table sparse for short probe sequences */
+	if (nflows >= MAXFLOWS / 4 * 3)
+		return NULL;
+
+	nflows++;
+	f->used = 1;
+	f->ifindex = ifindex;
+	f->id = id;
+	f->lat_min = UINT32_MAX;
+
+	return f;
+}
+
+static void add_latency(struct latstat *st, uint32_t lat)
+{
+	st->sum += lat;
+	if (lat < st->min)
+		st->min = lat;
+	if (lat > st->max)
+		st->max = lat;
+
+	if (lat / 1000 < LATHISTSZ)
+		st->hist[lat / 1000]++;
+	else
+		st->over++;
+}
+
+/* process the sequence number and the latency of a received frame */
+static void rx_frame(struct canfd_frame *cf, int ifindex, uint32_t rxts)
+{
+	struct flow *f;
+	uint32_t seq, txts, lat;
+	int32_t d;
+	unsigned int back, b;
+	int i;
+
+	/* see cangen.c: sequence number and TX timestamp (little endian) */
+	if ((cf->can_id & (CAN_RTR_FLAG | CAN_ERR_FLAG)) || cf->len < 8) {
+		ignored++;
+		return;
+	}
+
+	f = get_flow(ifindex, cf->can_id);
+	if (!f) {
+		untracked++;
+		return;
+	}
+
+	seq = txts = 0;
+	for (i = 3; i >= 0; i--) {
+		seq = (seq << 8) | cf->data[i];
+		txts = (txts << 8) | cf->data[4 + i];
+	}
+
+	/* the clocks are identical - negative values are rounding effects */
+	lat = rxts - txts;
+	if ((int32_t)lat < 0)
+		lat = 0;
+
+	d = seq - f->next;
+
+	if (!f->rx) {
+		f->next = seq + 1;
+		f->win = 1;
+	} else if (d >= 0) {
+		/* in sequence - or some frames are missing */
+		f->lost += d;
+		total.lost += d;
+		interval.lost += d;
+
+		if (d + 1 >= SEQWIN)
+			f->win = 1;
+		else
+			f->win = (f->win << (d + 1)) | 1;
+		f->next = seq + 1;
+	} else {
+		/* bit 0 in the window is the sequence number 'next - 1' */
+		back = -(d + 1);
+		if (back >= SEQWIN) {
+			/* far behind the window - e.g. a restarted cangen */
+			f->next = seq + 1;
+			f->win = 1;
+		} else if ((f->win >> back) & 1) {
+			f->dup++;
+			total.dup++;
+			interval.dup++;
+		} else {
+			f->reorder++;
+			total.reorder++;
+			interval.reorder++;
+			f->win |= 1ULL << back;
+			if (f->lost) {
+				f->lost--;
+				total.lost--;
+				if (interval.lost)
+					interval.lost--;
+			}
+		}
+	}
+
+	f->rx++;
+	total.rx++;
+	interval.rx++;
+
+	f->lat_sum += lat;
+	if (lat < f->lat_min)
+		f->lat_min = lat;
+	if (lat > f->lat_max)
+		f->lat_max = lat;
+
+	for (b = 0; b < LOGHISTSZ - 1 && lat >> b; b++)
+		;
+	f->hist[b]++;
+
+	add_latency(&total, lat);
+	add_latency(&interval, lat);
+}
+
+/* latency in us below which the given share of the frames was received */
+static double percentile(struct latstat *st, double p)
+{
+	unsigned long long cnt = 0, limit = st->rx * p;
+	unsigned int i;
+
+	/* upper bound of the bucket - but not above the maximum */
+	for (i = 0; i < LATHISTSZ; i++) {
+		cnt += st->hist[i];
+		if (cnt > limit)
+			return (i + 1 < st->max / 1000.0)?i + 1:st->max / 1000.0;
+	}
+
+	return st->max / 1000.0;
+}
+
+static void print_latstat(const char *name, struct latstat *st)
+{
+	printf("%-8s rx %10llu  lost %8llu  reorder %8llu  dup %8llu",
+	       name, st->rx, st->lost, st->reorder, st->dup);
+
+	if (st->rx)
+		printf("  latency min %.1f avg %.1f p50 %.0f p99 %.0f p999 %.0f max %.1f us",
+		       st->min / 1000.0, st->sum / 1000.0 / st->rx,
+		       percentile(st, 0.5), percentile(st, 0.99),
+		       percentile(st, 0.999), st->max / 1000.0);
+
+	printf("\n");
+}
+
+static int cmp_flow(const void *a, const void *b)
+{
+	const struct flow *fa = a, *fb = b;
+
+	if (fa->ifindex != fb->ifindex)
+		return (fa->ifindex < fb->ifindex)?-1:1;
+	if (fa->id != fb->id)
+		return (fa->id < fb->id)?-1:1;
+
+	return 0;
+}
+
+static void print_flows(void)
+{
+	char ifname[IF_NAMESIZE];
+	char id[9];
+	unsigned long long cnt;
+	struct flow *f;
+	unsigned int i, n, b;
+	double p99;
+
+	/* compact and sort the hash table - it is not used afterwards */
+	for (i = 0, n = 0; i < MAXFLOWS; i++) {
+		if (flows[i].used)
+			flows[n++] = flows[i];
+	}
+	qsort(flows, n, sizeof(*flows), cmp_flow);
+
+	printf("\n%-*s %8s %10s %8s %8s %8s %10s %10s %10s %10s\n",
+	       IF_NAMESIZE, "interface", "CAN ID", "rx", "lost", "reorder", "dup",
+	       "min/us", "avg/us", "p99/us", "max/us");
+
+	for (i = 0; i < n; i++) {
+		f = &flows[i];
+
+		/* upper bound of the log2 histogram bucket */
+		for (b = 0, cnt = 0; b < LOGHISTSZ; b++) {
+			cnt += f->hist[b];
+			if (cnt > f->rx * 0.99)
+				break;
+		}
+
+		p99 = (b < 32)?(1U << b) / 1000.0:f->lat_max / 1000.0;
+		if (p99 > f->lat_max / 1000.0)
+			p99 = f->lat_max / 1000.0;
+
+		if (!if_indextoname(f->ifindex, ifname))
+			snprintf(ifname, sizeof(ifname), "#%d", f->ifindex);
+
+		if (f->id & CAN_EFF_FLAG)
+			snprintf(id, sizeof(id), "%08X", f->id & CAN_EFF_MASK);
+		else
+			snprintf(id, sizeof(id), "%03X", f->id & CAN_SFF_MASK);
+
+		printf("%-*s %8s %10llu %8llu %8llu %8llu %10.1f %10.1f %10.1f %10.1f\n",
+		       IF_NAMESIZE, ifname, id, f->rx, f->lost,
+		       f->reorder, f->dup, f->lat_min / 1000.0,
+		       f->lat_sum / 1000.0 / f->rx, p99, f->lat_max / 1000.0);
+	}
+}
+
+static void print_histogram(void)
+{
+	unsigned int i;
+
+	printf("\nlatency histogram (us frames):\n");
+	for (i = 0; i < LATHISTSZ; i++) {
+		if (total.hist[i])
+			printf("%6u %10u\n", i, total.hist[i]);
+	}
+	if (total.over)
+		printf(">=%u %10llu\n", LATHISTSZ, total.over);
+}
+
+static int open_socket(char *ifname)
+{
+	struct sockaddr_can addr;
+	struct ifreq ifr;
+	const int on = 1;
+	int s;
+
+	s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+	if (s < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	if (strlen(ifname) >= IFNAMSIZ) {
+		printf("name of CAN device '%s' is too long!\n", ifname);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+
+	if (strcmp(ANYDEV, ifname)) {
+		memset(&ifr, 0, sizeof(ifr));
+		strcpy(ifr.ifr_name, ifname);
+		if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
+			perror("SIOCGIFINDEX");
+			return -1;
+		}
+		addr.can_ifindex = ifr.ifr_ifindex;
+	} else
+		addr.can_ifindex = 0; /* any CAN device */
+
+	/* try to switch the socket into CAN FD mode */
+	setsockopt(s, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &on, sizeof(on));
+
+	if (setsockopt(s, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0) {
+		perror("setsockopt SO_TIMESTAMPNS");
+		return -1;
+	}
+
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return -1;
+	}
+
+	return s;
+}
+
+int main(int argc, char **argv)
+{
+	struct pollfd fds[MAXSOCK];
+	struct canfd_frame frames[BATCHSZ];
+	struct sockaddr_can rxaddr[BATCHSZ];
+	struct iovec iov[BATCHSZ];
+	struct mmsghdr mmsg[BATCHSZ];
+	char ctrlmsg[BATCHSZ][CTRLMSG_LEN];
+	struct cmsghdr *cmsg;
+	struct timespec ts;
+	unsigned long long offset, rxns, next = 0;
+	double secs = 1.0;
+	unsigned long count = 0;
+	int summary = 0;
+	int histogram = 0;
+	int currmax, timeout;
+	int opt, num, i, j;
+
+	signal(SIGTERM, sigterm);
+	signal(SIGHUP, sigterm);
+	signal(SIGINT, sigterm);
+
+	while ((opt = getopt(argc, argv, "t:n:sHh?")) != -1) {
+		switch (opt) {
+		case 't':
+			secs = strtod(optarg, NULL);
+			if (secs < 0) {
+				print_usage(basename(argv[0]));
+				return 1;
+			}
+			break;
+
+		case 'n':
+			count = strtoul(optarg, NULL, 10);
+			break;
+
+		case 's':
+			summary = 1;
+			break;
+
+		case 'H':
+			histogram = 1;
+			break;
+
+		default:
+			print_usage(basename(argv[0]));
+			return 1;
+		}
+	}
+
+	if (optind == argc) {
+		print_usage(basename(argv[0]));
+		return 1;
+	}
+
+	currmax = argc - optind;
+	if (currmax > MAXSOCK) {
+		printf("More than %d CAN devices given on commandline!\n", MAXSOCK);
+		return 1;
+	}
+
+	flows = calloc(MAXFLOWS, sizeof(*flows));
+	if (!flows) {
+		perror("calloc");
+		return 1;
+	}
+
+	init_latstat(&total);
+	init_latstat(&interval);
+
+	for (i = 0; i < currmax; i++) {
+		fds[i].fd = open_socket(argv[optind + i]);
+		if (fds[i].fd < 0)
+			return 1;
+		fds[i].events = POLLIN;
+	}
+
+	for (j = 0; j < BATCHSZ; j++) {
+		iov[j].iov_base = &frames[j];
+		mmsg[j].msg_hdr.msg_name = &rxaddr[j];
+		mmsg[j].msg_hdr.msg_iov = &iov[j];
+		mmsg[j].msg_hdr.msg_iovlen = 1;
+		mmsg[j].msg_hdr.msg_control = &ctrlmsg[j];
+	}
+
+	if (secs)
+		next = now_ns(CLOCK_MONOTONIC) + secs * 1e9;
+
+	while (running) {
+
+		if (secs) {
+			rxns = now_ns(CLOCK_MONOTONIC);
+			if (rxns >= next) {
+				print_latstat("interval", &interval);
+				fflush(stdout);
+				init_latstat(&interval);
+				next += secs * 1e9;
+				if (next < rxns)
+					next = rxns + secs * 1e9;
+			}
+			timeout = (next - rxns) / 1000000 + 1;
+		} else
+			timeout = -1;
+
+		if (poll(fds, currmax, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			return 1;
+		}
+
+		for (i = 0; i < currmax && running; i++) {
+
+			if (!(fds[i].revents & POLLIN))
+				continue;
+
+			/* these settings may be modified by recvmmsg() */
+			for (j = 0; j < BATCHSZ; j++) {
+				iov[j].iov_len = sizeof(frames[j]);
+				mmsg[j].msg_hdr.msg_namelen = sizeof(rxaddr[j]);
+				mmsg[j].msg_hdr.msg_controllen = sizeof(ctrlmsg[j]);
+				mmsg[j].msg_hdr.msg_flags = 0;
+			}
+
+			num = recvmmsg(fds[i].fd, mmsg, BATCHSZ, MSG_DONTWAIT, NULL);
+			if (num < 0) {
+				if (errno == EAGAIN || errno == EINTR)
+					continue;
+				perror("read");
+				return 1;
+			}
+
+			/* convert the CLOCK_REALTIME socket timestamps */
+			rxns = now_ns(CLOCK_MONOTONIC);
+			offset = now_ns(CLOCK_REALTIME) - rxns;
+
+			for (j = 0; j < num; j++) {
+
+				if (mmsg[j].msg_len != CAN_MTU &&
+				    mmsg[j].msg_len != CANFD_MTU) {
+					fprintf(stderr, "read: incomplete CAN frame\n");
+					return 1;
+				}
+
+				ts.tv_sec = 0;
+				for (cmsg = CMSG_FIRSTHDR(&mmsg[j].msg_hdr);
+				     cmsg && (cmsg->cmsg_level == SOL_SOCKET);
+				     cmsg = CMSG_NXTHDR(&mmsg[j].msg_hdr, cmsg)) {
+					if (cmsg->cmsg_type == SO_TIMESTAMPNS)
+						memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+				}
+
+				if (ts.tv_sec)
+					rx_frame(&frames[j], rxaddr[j].can_ifindex,
+						 ts.tv_sec * 1000000000ULL + ts.tv_nsec - offset);
+				else
+					rx_frame(&frames[j], rxaddr[j].can_ifindex, rxns);
+
+				if (count && total.rx + ignored + untracked >= count) {
+					running = 0;
+					break;
+				}
+			}
+		}
+	}
+
+	printf("\n");
+	print_latstat("total", &total);
+
+	if (ignored)
+		printf("%llu frames without sequence number\n", ignored);
+	if (untracked)
+		printf("%llu frames of more than %d CAN IDs not evaluated\n",
+		       untracked, MAXFLOWS / 4 * 3);
+
+	if (!summary)
+		print_flows();
+
+	if (histogram)
+		print_histogram();
+
+	for (i = 0; i < currmax; i++)
+		close(fds[i].fd);
+
+	free(flows);
+
+	return 0;
+}
@@ -0,0 +1,331 @@
+/* SPDX-License-Identifier: (GPL-2.0-only OR BSD-3-Clause) */
+/*
+ * canlibbench.c - benchmark for the CAN frame formatting and parsing
+ *                 functions in lib.c and canframelen.c
+ *
+ * The frame corpora are created with a fixed seed so that the results of
+ * different builds (e.g. before/after a change in lib.c) can be compared.
+ * Use '-o csv' or '-o json' to store the results for regression tracking.
+ *
+ * Send feedback to <linux-can@vger.kernel.org>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <libgen.h>
+#include <time.h>
+
+#include <linux/can.h>
+#include <linux/can/error.h>
+
+#include "lib.h"
+#include "canframelen.h"
+
+#define CORPUSSZ 1024 /* frames per corpus - fits into the L1/L2 cache */
+#define DEFAULT_FRAMES 2000000 /* processed frames per benchmark */
+#define BATCHSZ 64 /* frames per call of the batch functions */
+
+#define OUT_TEXT 0
+#define OUT_CSV 1
+#define OUT_JSON 2
+
+struct corpus {
+	const char *name;
+	int mtu;
+	struct canfd_frame frame[CORPUSSZ];
+	int mtus[CORPUSSZ]; /* mtu of each frame for the batch functions */
+	char str[CORPUSSZ][CL_CFSZ]; /* compact ASCII representation */
+};
+
+static struct corpus corpus[] = {
+	{ .name = "sff", .mtu = CAN_MTU },
+	{ .name = "eff", .mtu = CAN_MTU },
+	{ .name = "rtr", .mtu = CAN_MTU },
+	{ .name = "err", .mtu = CAN_MTU },
+	{ .name = "fd", .mtu = CANFD_MTU },
+	{ .name = "fdeff", .mtu = CANFD_MTU },
+};
+
+#define CORPORA (sizeof(corpus) / sizeof(corpus[0]))
+
+static volatile unsigned long sink; /* keep the compiler from dropping results */
+
+static uint32_t rnd_state = 0x2545F491;
+
+static uint32_t rnd(void)
+{
+	/* xorshift32 - reproducible frames on every run */
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state;
+}
+
+static void create_corpus(struct corpus *c)
+{
+	struct canfd_frame *cf;
+	int i, j, maxdlen;
+
+	for (i = 0; i < CORPUSSZ; i++) {
+		cf = &c->frame[i];
+		memset(cf, 0, sizeof(*cf));
+
+		if (!strcmp(c->name, "sff")) {
+			cf->can_id = rnd() & CAN_SFF_MASK;
+			cf->len = rnd() % (CAN_MAX_DLEN + 1);
+		} else if (!strcmp(c->name, "eff")) {
+			cf->can_id = (rnd() & CAN_EFF_MASK) | CAN_EFF_FLAG;
+			cf->len = rnd() % (CAN_MAX_DLEN + 1);
+		} else if (!strcmp(c->name, "rtr")) {
+			cf->can_id = (rnd() & CAN_SFF_MASK) | CAN_RTR_FLAG;
+			cf->len = rnd() % (CAN_MAX_DLEN + 1);
+		} else if (!strcmp(c->name, "err")) {
+			cf->can_id = CAN_ERR_FLAG | (rnd() & CAN_ERR_MASK & 0x1FF);
+			cf->len = CAN_ERR_DLC;
+		} else if (!strcmp(c->name, "fd")) {
+			cf->can_id = rnd() & CAN_SFF_MASK;
+			cf->len = can_dlc2len(rnd() & 0xF);
+			cf->flags = CANFD_BRS;
+		} else {
+			cf->can_id = (rnd() & CAN_EFF_MASK) | CAN_EFF_FLAG;
+			cf->len = can_dlc2len(rnd() & 0xF);
+			cf->flags = rnd() & (CANFD_BRS | CANFD_ESI);
+		}
+
+		if (!(cf->can_id & CAN_RTR_FLAG)) {
+			for (j = 0; j < cf->len; j++)
+				cf->data[j] = rnd();
+		}
+
+		c->mtus[i] = c->mtu;
+		maxdlen = (c->mtu == CANFD_MTU)?CANFD_MAX_DLEN:CAN_MAX_DLEN;
+		sprint_canframe(c->str[i], cf, 0, maxdlen);
+	}
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* benchmarked functions - 'i' is the frame index in the corpus */
+
+static void bench_sprint_canframe(struct corpus *c, int i)
+{
+	char buf[CL_CFSZ];
+	int maxdlen = (c->mtu == CANFD_MTU)?CANFD_MAX_DLEN:CAN_MAX_DLEN;
+
+	sink += sprint_canframe(buf, &c->frame[i], 0, maxdlen);
+}
+
+static void bench_sprint_canframe_sep(struct corpus *c, int i)
+{
+	char buf[CL_CFSZ];
+	int maxdlen = (c->mtu == CANFD_MTU)?CANFD_MAX_DLEN:CAN_MAX_DLEN;
+
+	sink += sprint_canframe(buf, &c->frame[i], 1, maxdlen);
+}
+
+static void bench_sprint_long_canframe(struct corpus *c, int i)
+{
+	char buf[CL_LONGCFSZ];
+	int maxdlen = (c->mtu == CANFD_MTU)?CANFD_MAX_DLEN:CAN_MAX_DLEN;
+
+	sink += sprint_long_canframe(buf, &c->frame[i],
+				     CANLIB_VIEW_INDENT_SFF | CANLIB_VIEW_ASCII, maxdlen);
+}
+
+static void bench_parse_canframe(struct corpus *c, int i)
+{
+	struct canfd_frame cf;
+
+	sink += parse_canframe(c->str[i], &cf);
+}
+
+static void bench_snprintf_can_error_frame(struct corpus *c, int i)
+{
+	char buf[CL_LONGCFSZ];
+
+	snprintf_can_error_frame(buf, sizeof(buf), &c->frame[i], ",");
+	sink += buf[0];
+}
+
+static void bench_cfl_no_bitstuffing(struct corpus *c, int i)
+{
+	sink += can_frame_length(&c->frame[i], CFL_NO_BITSTUFFING, c->mtu);
+}
+
+static void bench_cfl_worstcase(struct corpus *c, int i)
+{
+	sink += can_frame_length(&c->frame[i], CFL_WORSTCASE, c->mtu);
+}
+
+static void bench_cfl_exact(struct corpus *c, int i)
+{
+	sink += can_frame_length(&c->frame[i], CFL_EXACT, c->mtu);
+}
+
+static void bench_cfl_phases(struct corpus *c, int i)
+{
+	unsigned data_bits;
+
+	sink += can_frame_length_phases(&c->frame[i], CFL_EXACT, c->mtu, &data_bits);
+	sink += data_bits;
+}
+
+static void bench_cfl_batch(struct corpus *c, int i)
+{
+	/* one call for BATCHSZ frames - still gives the time per frame */
+	if (i % BATCHSZ == 0)
+		sink += can_frames_length(&c->frame[i], &c->mtus[i], BATCHSZ,
+					  CFL_EXACT, NULL);
+}
+
+static const struct {
+	const char *name;
+	void (*func)(struct corpus *c, int i);
+	int err_only; /* only useful for error frames */
+} bench[] = {
+	{ "sprint_canframe", bench_sprint_canframe, 0 },
+	{ "sprint_canframe_sep", bench_sprint_canframe_sep, 0 },
+	{ "sprint_long_canframe", bench_sprint_long_canframe, 0 },
+	{ "parse_canframe", bench_parse_canframe, 0 },
+	{ "snprintf_can_error_frame", bench_snprintf_can_error_frame, 1 },
+	{ "can_frame_length_nobs", bench_cfl_no_bitstuffing, 0 },
+	{ "can_frame_length_worst", bench_cfl_worstcase, 0 },
+	{ "can_frame_length_exact", bench_cfl_exact, 0 },
+	{ "can_frame_length_phases", bench_cfl_phases, 0 },
+	{ "can_frames_length_exact", bench_cfl_batch, 0 },
+};
+
+#define BENCHES (sizeof(bench) / sizeof(bench[0]))
+
+void print_usage(char *prg)
+{
+	unsigned int i;
+
+	fprintf(stderr, "%s - benchmark for the CAN frame functions of the CAN library.\n", prg);
+	fprintf(stderr, "\nUsage: %s [options]\n", prg);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "         -n <count>  (process <count> frames per benchmark - default %d)\n", DEFAULT_FRAMES);
+	fprintf(stderr, "         -f <func>   (run only benchmarks starting with <func>)\n");
+	fprintf(stderr, "         -c <corpus> (run only the given corpus)\n");
+	fprintf(stderr, "         -o <fmt>    (output format: text (default), csv, json)\n");
+	fprintf(stderr, "\nBenchmarks:\n ");
+	for (i = 0; i < BENCHES; i++)
+		fprintf(stderr, " %s", bench[i].name);
+	fprintf(stderr, "\n\nCorpora:\n ");
+	for (i = 0; i < CORPORA; i++)
+		fprintf(stderr, " %s", corpus[i].name);
+	fprintf(stderr, "\n\n");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long frames = DEFAULT_FRAMES;
+	char *funcname = NULL;
+	char *corpusname = NULL;
+	int out = OUT_TEXT;
+	unsigned long n;
+	unsigned int b, c;
+	double start, ns;
+	int first = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:f:c:o:?")) != -1) {
+		switch (opt) {
+		case 'n':
+			frames = strtoul(optarg, NULL, 0);
+			if (!frames) {
+				print_usage(basename(argv[0]));
+				return 1;
+			}
+			break;
+
+		case 'f':
+			funcname = optarg;
+			break;
+
+		case 'c':
+			corpusname = optarg;
+			break;
+
+		case 'o':
+			if (!strcmp(optarg, "text"))
+				out = OUT_TEXT;
+			else if (!strcmp(optarg, "csv"))
+				out = OUT_CSV;
+			else if (!strcmp(optarg, "json"))
+				out = OUT_JSON;
+			else {
+				print_usage(basename(argv[0]));
+				return 1;
+			}
+			break;
+
+		default:
+			print_usage(basename(argv[0]));
+			return 1;
+		}
+	}
+
+	for (c = 0; c < CORPORA; c++)
+		create_corpus(&corpus[c]);
+
+	if (out == OUT_TEXT)
+		printf("%-26s %-6s %10s %14s\n", "benchmark", "corpus", "ns/frame", "frames/s");
+	else if (out == OUT_CSV)
+		printf("benchmark,corpus,frames,ns_per_frame,frames_per_s\n");
+	else
+		printf("[\n");
+
+	for (b = 0; b < BENCHES; b++) {
+
+		if (funcname && strncmp(bench[b].name, funcname, strlen(funcname)))
+			continue;
+
+		for (c = 0; c < CORPORA; c++) {
+
+			if (corpusname && strcmp(corpus[c].name, corpusname))
+				continue;
+
+			if (bench[b].err_only && strcmp(corpus[c].name, "err"))
+				continue;
+
+			/* warm up caches and branch predictors */
+			for (n = 0; n < CORPUSSZ; n++)
+				bench[b].func(&corpus[c], n);
+
+			start = now_ns();
+			for (n = 0; n < frames; n++)
+				bench[b].func(&corpus[c], n % CORPUSSZ);
+			ns = (now_ns() - start) / frames;
+
+			if (out == OUT_TEXT)
+				printf("%-26s %-6s %10.2f %14.0f\n",
+				       bench[b].name, corpus[c].name, ns, 1e9 / ns);
+			else if (out == OUT_CSV)
+				printf("%s,%s,%lu,%.3f,%.0f\n",
+				       bench[b].name, corpus[c].name, frames, ns, 1e9 / ns);
+			else {
+				printf("%s  {\"benchmark\": \"%s\", \"corpus\": \"%s\", \"frames\": %lu, "
+				       "\"ns_per_frame\": %.3f, \"frames_per_s\": %.0f}",
+				       (first)?"":",\n", bench[b].name, corpus[c].name,
+				       frames, ns, 1e9 / ns);
+				first = 0;
+			}
+		}
+	}
+
+	if (out == OUT_JSON)
+		printf("\n]\n");
+
+	return 0;
+}
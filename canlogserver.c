@@ -77,8 +77,7 @@
 
 #define DEFPORT 28700
 
-static char devname[MAXDEV][IFNAMSIZ+1];
-static int  dindex[MAXDEV];
+static struct ifcache ifcache; /* interface index to name cache */
 static int  max_devname_len;
 
 extern int optind, opterr, optopt;
@@ -104,50 +103,12 @@ void print_usage(char *prg)
 	fprintf(stderr, "\nUse interface name '%s' to receive from all CAN interfaces.\n\n", ANYDEV);
 }
 
-int idx2dindex(int ifidx, int socket)
+int idx2dindex(int ifidx)
 {
-	int i;
-	struct ifreq ifr;
-
-	for (i=0; i<MAXDEV; i++) {
-		if (dindex[i] == ifidx)
-			return i;
-	}
-
-	/* create new interface index cache entry */
-
-	/* remove index cache zombies first */
-	for (i=0; i < MAXDEV; i++) {
-		if (dindex[i]) {
-			ifr.ifr_ifindex = dindex[i];
-			if (ioctl(socket, SIOCGIFNAME, &ifr) < 0)
-				dindex[i] = 0;
-		}
-	}
-
-	for (i=0; i < MAXDEV; i++)
-		if (!dindex[i]) /* free entry */
-			break;
-
-	if (i == MAXDEV) {
-		printf("Interface index cache only supports %d interfaces.\n", MAXDEV);
-		exit(1);
-	}
+	int i = ifcache_index(&ifcache, ifidx);
 
-	dindex[i] = ifidx;
-
-	ifr.ifr_ifindex = ifidx;
-	if (ioctl(socket, SIOCGIFNAME, &ifr) < 0)
-		perror("SIOCGIFNAME");
-
-	if (max_devname_len < (int)strlen(ifr.ifr_name))
-		max_devname_len = strlen(ifr.ifr_name);
-
-	strcpy(devname[i], ifr.ifr_name);
-
-#ifdef DEBUG
-	printf("new index %d (%s)\n", i, devname[i]);
-#endif
+	if (max_devname_len < ifcache.max_len)
+		max_devname_len = ifcache.max_len;
 
 	return i;
 }
@@ -370,18 +331,31 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (ifcache_open(&ifcache, s[0])) {
+		fprintf(stderr, "Failed to create interface name cache!\n");
+		return 1;
+	}
+
 	while (running) {
 
 		FD_ZERO(&rdfs);
 		for (i=0; i<currmax; i++)
 			FD_SET(s[i], &rdfs);
 
-		if ((ret = select(s[currmax-1]+1, &rdfs, NULL, NULL, NULL)) < 0) {
+		/* the netlink socket is created after the CAN sockets */
+		if (ifcache.nl >= 0)
+			FD_SET(ifcache.nl, &rdfs);
+
+		if ((ret = select(((ifcache.nl >= 0)?ifcache.nl:s[currmax-1])+1,
+				  &rdfs, NULL, NULL, NULL)) < 0) {
 			//perror("select");
 			running = 0;
 			continue;
 		}
 
+		if (ifcache.nl >= 0 && FD_ISSET(ifcache.nl, &rdfs))
+			ifcache_update(&ifcache);
+
 		for (i=0; i<currmax; i++) {  /* check all CAN RAW sockets */
 
 			if (FD_ISSET(s[i], &rdfs)) {
@@ -408,14 +382,14 @@ int main(int argc, char **argv)
 					perror("SIOCGSTAMP");
 
 
-				idx = idx2dindex(addr.can_ifindex, s[i]);
+				idx = idx2dindex(addr.can_ifindex);
 
-				sprintf(temp, "(%lu.%06lu) %*s ",
-					tv.tv_sec, tv.tv_usec, max_devname_len, devname[idx]);
-				sprint_canframe(temp+strlen(temp), &frame, 0, maxdlen); 
-				strcat(temp, "\n");
+				nbytes = sprintf(temp, "(%lu.%06lu) %*s ",
+						 tv.tv_sec, tv.tv_usec, max_devname_len, ifcache.entry[idx].name);
+				nbytes += sprint_canframe(temp+nbytes, &frame, 0, maxdlen);
+				temp[nbytes++] = '\n';
 
-				if (write(accsocket, temp, strlen(temp)) < 0) {
+				if (write(accsocket, temp, nbytes) < 0) {
 					perror("writeaccsock");
 					return 1;
 				}
@@ -423,7 +397,7 @@ int main(int argc, char **argv)
 #if 0
 				/* print CAN frame in log file style to stdout */
 				printf("(%lu.%06lu) ", tv.tv_sec, tv.tv_usec);
-				printf("%*s ", max_devname_len, devname[idx]);
+				printf("%*s ", max_devname_len, ifcache.entry[idx].name);
 				fprint_canframe(stdout, &frame, "\n", 0, maxdlen);
 #endif
 			}
@@ -434,6 +408,7 @@ int main(int argc, char **argv)
 	for (i=0; i<currmax; i++)
 		close(s[i]);
 
+	ifcache_close(&ifcache);
 	close(accsocket);
 	return 0;
 }
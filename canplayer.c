@@ -48,11 +48,20 @@
 #include <libgen.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <limits.h>
+#include <pthread.h>
 
 #include <net/if.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <linux/can.h>
 #include <linux/can/raw.h>
 
@@ -60,19 +69,99 @@
 
 #define DEFAULT_GAP	1	/* ms */
 #define DEFAULT_LOOPS	1	/* only one replay */
-#define CHANNELS	20	/* anyone using more than 20 CAN interfaces at a time? */
 #define COMMENTSZ 200
 #define BUFSZ (sizeof("(1345212884.318850)") + IFNAMSIZ + 4 + CL_CFSZ + COMMENTSZ) /* for one line in the logfile */
 #define STDOUTIDX	65536	/* interface index for printing on stdout - bigger than max uint16 */
+#define AVG_LINESZ	40	/* to estimate the number of frames in a mapped logfile */
+#define ERRHISTSZ	10000	/* timing error histogram with 1us resolution */
+#define BATCHSZ		64	/* max. frames sent with one sendmmsg() syscall */
+#define POLL_MIN	1	/* ms - initial backoff on ENOBUFS */
+#define POLL_MAX	64	/* ms - max. backoff on ENOBUFS */
+#define ENOBUFS_TIMEOUT	5000	/* ms - give up when the netdev queue does not drain */
+#define INDEX_STEP	(1024 * 1024)	/* bytes between two seek index entries */
+#define INDEX_CHUNK	4096	/* read from the logfile to find an index entry */
+#define MIN_SPEED	0.1
+#define MAX_SPEED	100.0
+#define START_DELAY	10000000ULL	/* ns - common start of all sender threads */
 
 struct assignment {
 	char txif[IFNAMSIZ];
 	int  txifidx;
 	char rxif[IFNAMSIZ];
 };
-static struct assignment asgn[CHANNELS];
+static struct assignment *asgn;
+static int asgn_cnt, asgn_max;
 const int canfd_on = 1;
 
+/* one CAN frame from the logfile - ready to be sent */
+struct logframe {
+	struct timeval tv;		/* timestamp from the logfile */
+	const char *line;		/* logfile line for the stdout hook (NULL for binary logs) */
+	int linelen;
+	int asgn;			/* index in the assignment table */
+	int mtu;			/* CAN_MTU / CANFD_MTU (0 = not parsed for the stdout hook) */
+	unsigned long long rel_ns;	/* deadline relative to the replay start (-p) */
+	struct canfd_frame frame;
+};
+
+/* pre-parsed logfile content (-m) */
+static struct logframe *frames;
+static unsigned long nframes, maxframes;
+static char *map;
+static size_t mapsz;
+static int preparse;
+
+/* replay time window (-w) in logfile time (us) */
+static unsigned long long win_start, win_stop = ~0ULL;
+static int win_rel; /* 1: start, 2: stop relative to the first frame */
+
+/* sparse logfile timestamp -> file offset index to seek to the window start */
+struct seekidx {
+	unsigned long long us;
+	long long offset;
+};
+static struct seekidx *seekidx;
+static unsigned long seekidx_cnt;
+
+struct txslot {
+	struct canfd_frame frame;
+	struct sockaddr_can addr;
+	struct iovec iov;
+	int asgn;
+	unsigned long long deadline;
+};
+
+/* CAN_RAW socket with its tx batch and timing statistics */
+struct sender {
+	int s;
+	const char *name;		/* tx interface name (-p) */
+	int txifidx;			/* tx interface index (-p) */
+	unsigned long *idx;		/* frames[] sent by this thread (-p) */
+	unsigned long cnt;
+	pthread_t thread;
+	int err;
+
+	/* frames to be sent with the next sendmmsg() */
+	struct txslot slot[BATCHSZ];
+	struct mmsghdr msg[BATCHSZ];
+	int txcnt;
+
+	/* deviation of the send time from the scheduled deadline (-S) */
+	unsigned long long err_cnt, err_sum, err_max;
+	unsigned long err_hist[ERRHISTSZ + 1]; /* last entry: >= ERRHISTSZ us */
+	unsigned long enobufs_count;
+};
+
+static struct sender main_sender;
+
+/* per tx interface sender threads (-p) */
+static struct sender *senders;
+static int nsenders;
+static unsigned long long par_epoch, par_looplen, par_busywait;
+static int par_loops, par_verbose, par_use_timestamps;
+
+static volatile int running = 1;
+
 extern int optind, opterr, optopt;
 
 void print_usage(char *prg)
@@ -85,12 +174,29 @@ void print_usage(char *prg)
                 "(process input file <num> times)\n"
                 "                      "
                 "(Use 'i' for infinite loop - default: %d)\n", DEFAULT_LOOPS);
+        fprintf(stderr, "         -m           (map and pre-parse the "
+                "infile before replay - implied by -l\n"
+                "                       and binary logfiles)\n");
         fprintf(stderr, "         -t           (ignore timestamps: "
                 "send frames immediately)\n");
-        fprintf(stderr, "         -g <ms>      (gap in milli "
-                "seconds - default: %d ms)\n", DEFAULT_GAP);
+        fprintf(stderr, "         -g <ms>      (poll the logfile timestamps "
+                "with a gap in milli seconds\n"
+                "                       instead of using absolute deadlines)\n");
+        fprintf(stderr, "         -b <us>      (busy-wait the last <us> "
+                "micro seconds before a deadline)\n");
+        fprintf(stderr, "         -S           (print timing error "
+                "statistics on exit)\n");
         fprintf(stderr, "         -s <s>       (skip gaps in "
                 "timestamps > 's' seconds)\n");
+        fprintf(stderr, "         -f <factor>  (replay speed factor "
+                "%.1f .. %.0f - default: 1.0)\n", MIN_SPEED, MAX_SPEED);
+        fprintf(stderr, "         -w <start>[,<stop>]\n"
+                "                      (replay only the frames with "
+                "logfile timestamps in [start, stop]\n"
+                "                       in seconds - use '+<s>' for times "
+                "relative to the first frame)\n");
+        fprintf(stderr, "         -p           (use one socket and "
+                "sender thread per write-if - implies -m)\n");
         fprintf(stderr, "         -x           (disable local "
                 "loopback of sent CAN frames)\n");
         fprintf(stderr, "         -v           (verbose: print "
@@ -105,6 +211,13 @@ void print_usage(char *prg)
 		"had been received from\n\n");
 	fprintf(stderr, "Lines in the logfile not beginning with '(' (start of "
 		"timestamp) are ignored.\n\n");
+	fprintf(stderr, "For -w the seek index of a logfile is stored in "
+		"<infile>.idx when possible.\n\n");
+}
+
+void sigterm(int signo)
+{
+	running = 0;
 }
 
 /* copied from /usr/src/linux/include/linux/time.h ...
@@ -121,140 +234,1175 @@ static inline int timeval_compare(struct timeval *lhs, struct timeval *rhs)
 	return lhs->tv_usec - rhs->tv_usec;
 }
 
-static inline void create_diff_tv(struct timeval *today, struct timeval *diff,
-				  struct timeval *log) {
+static inline void create_diff_tv(struct timeval *today, struct timeval *diff,
+				  struct timeval *log) {
+
+	/* create diff_tv so that log_tv + diff_tv = today_tv */
+	diff->tv_sec  = today->tv_sec  - log->tv_sec;
+	diff->tv_usec = today->tv_usec - log->tv_usec;
+}
+
+static inline int frames_to_send(struct timeval *today, struct timeval *diff,
+				 struct timeval *log)
+{
+	/* return value <0 when log + diff < today */
+
+	struct timeval cmp;
+
+	cmp.tv_sec  = log->tv_sec  + diff->tv_sec;
+	cmp.tv_usec = log->tv_usec + diff->tv_usec;
+
+	if (cmp.tv_usec > 1000000) {
+		cmp.tv_usec -= 1000000;
+		cmp.tv_sec++;
+	}
+
+	if (cmp.tv_usec < 0) {
+		cmp.tv_usec += 1000000;
+		cmp.tv_sec--;
+	}
+
+	return timeval_compare(&cmp, today);
+}
+
+int get_asgn(const char *logif_name) {
+
+	int i;
+
+	for (i=0; i<asgn_cnt; i++) {
+		if (strcmp(asgn[i].rxif, logif_name) == 0) /* found device name */
+			return i; /* return index in the assignment table */
+	}
+
+	return -1; /* not found */
+}
+
+int add_assignment(char *mode, int socket, const char *txname, const char *rxname,
+		   int verbose) {
+
+	struct assignment *new;
+	struct ifreq ifr;
+	int i;
+
+	if (asgn_cnt == asgn_max) {
+		asgn_max = (asgn_max) ? asgn_max * 2 : 32;
+		new = realloc(asgn, asgn_max * sizeof(*asgn));
+		if (!new) {
+			perror("realloc");
+			return 1;
+		}
+		asgn = new;
+	}
+	i = asgn_cnt;
+
+	if (strlen(txname) >= IFNAMSIZ) {
+		fprintf(stderr, "write-if interface name '%s' too long!", txname);
+		return 1;
+	}
+	strcpy(asgn[i].txif, txname);
+
+	if (strlen(rxname) >= IFNAMSIZ) {
+		fprintf(stderr, "log-if interface name '%s' too long!", rxname);
+		return 1;
+	}
+	strcpy(asgn[i].rxif, rxname);
+
+	if (strcmp(txname, "stdout")) {
+		strcpy(ifr.ifr_name, txname);
+		if (ioctl(socket, SIOCGIFINDEX, &ifr) < 0) {
+			perror("SIOCGIFINDEX");
+			fprintf(stderr, "write-if interface name '%s' is wrong!\n", txname);
+			return 1;
+		}
+		asgn[i].txifidx = ifr.ifr_ifindex;
+	} else
+		asgn[i].txifidx = STDOUTIDX;
+
+	asgn_cnt++;
+
+	if (verbose > 1) /* use -v -v to see this */
+		printf("added %s assignment: log-if=%s write-if=%s write-if-idx=%d\n",
+		       mode, asgn[i].rxif, asgn[i].txif, asgn[i].txifidx);
+
+	return 0;
+}
+
+static int lookup_asgn(const char *device, int socket, int assignments, int verbose)
+{
+	/* returns the assignment index, -1 = not assigned, -2 = error */
+
+	int i = get_asgn(device);
+
+	if ((i < 0) && (!assignments)) {
+		/* device not found and no user assignments */
+		/* => assign this device automatically      */
+		if (add_assignment("auto", socket, device, device, verbose))
+			return -2;
+		i = get_asgn(device);
+	}
+
+	return i;
+}
+
+static inline void resolve_window(unsigned long long us)
+{
+	/* relative window times refer to the first frame in the logfile */
+	if (win_rel & 1)
+		win_start += us;
+	if (win_rel & 2)
+		win_stop += us;
+	win_rel = 0;
+}
+
+static inline int check_window(struct timeval *tv)
+{
+	/* returns 0 inside, 1 before and 2 after the replay time window */
+
+	unsigned long long us = tv->tv_sec * 1000000ULL + tv->tv_usec;
+
+	if (win_rel)
+		resolve_window(us);
+
+	if (us < win_start)
+		return 1;
+	if (us > win_stop)
+		return 2;
+
+	return 0;
+}
+
+/*
+ * Parse a logfile line '(sec.usec) device canframe ...' into 'lf'.
+ * Returns 0 for a frame to be replayed, 1 for a frame on a log interface
+ * without assignment or before the time window, 2 for a frame after the
+ * time window and -1 on errors.
+ */
+static int parse_logline(char *buf, struct logframe *lf, int socket,
+			 int assignments, int verbose)
+{
+	char device[IFNAMSIZ];
+	char *p, *end;
+	int len;
+
+	p = buf + 1; /* skip '(' */
+	lf->tv.tv_sec = strtoul(p, &end, 10);
+	if ((end == p) || (*end != '.'))
+		goto format_error;
+
+	p = end + 1;
+	lf->tv.tv_usec = strtoul(p, &end, 10);
+	if (*end != ')')
+		goto format_error;
+
+	/*
+	 * ensure the fractions of seconds are 6 decimal places long to catch
+	 * 3rd party or handcrafted logfiles that treat the timestamp as float
+	 */
+	if (end - p != 6) {
+		fprintf(stderr, "timestamp format in logfile requires 6 decimal places\n");
+		return -1;
+	}
+
+	len = check_window(&lf->tv);
+	if (len)
+		return len;
+
+	for (p = end + 1; *p == ' ' || *p == '\t'; p++)
+		;
+
+	for (len = 0; p[len] && p[len] != ' ' && p[len] != '\t' &&
+		     p[len] != '\n' && p[len] != '\r'; len++)
+		;
+
+	if (!len)
+		goto format_error;
+
+	if (len >= IFNAMSIZ) {
+		fprintf(stderr, "log interface name '%.*s' too long!", len, p);
+		return -1;
+	}
+	memcpy(device, p, len);
+	device[len] = 0;
+
+	for (p += len; *p == ' ' || *p == '\t'; p++)
+		;
+
+	if (!*p || *p == '\n' || *p == '\r')
+		goto format_error;
+
+	lf->asgn = lookup_asgn(device, socket, assignments, verbose);
+	if (lf->asgn == -2)
+		return -1;
+	if (lf->asgn < 0)
+		return 1;
+
+	lf->mtu = 0;
+	if (asgn[lf->asgn].txifidx != STDOUTIDX) {
+		lf->mtu = parse_canframe_token(p, &lf->frame, &len);
+		if (!lf->mtu) {
+			fprintf(stderr, "wrong CAN frame format: '%.*s'!", len, p);
+			return -1;
+		}
+	}
+
+	return 0;
+
+format_error:
+	fprintf(stderr, "incorrect line format in logfile\n");
+	return -1;
+}
+
+static struct logframe *new_logframe(void)
+{
+	struct logframe *new;
+
+	if (nframes == maxframes) {
+		maxframes = (maxframes) ? maxframes * 2 : 1024;
+		new = realloc(frames, maxframes * sizeof(*frames));
+		if (!new) {
+			perror("realloc");
+			return NULL;
+		}
+		frames = new;
+	}
+
+	return &frames[nframes];
+}
+
+static int load_binlog(FILE *infile, int socket, int assignments, int verbose)
+{
+	struct binlog bl;
+	struct binlog_entry e;
+	struct logframe *lf;
+	struct timeval tv;
+	int ret, win;
+
+	rewind(infile);
+	if (binlog_open_read(&bl, infile)) {
+		fprintf(stderr, "unsupported binary logfile format\n");
+		return 1;
+	}
+
+	while ((ret = binlog_read(&bl, &e)) > 0) {
+
+		if (e.type != BINLOG_REC_FRAME)
+			continue;
+
+		tv.tv_sec = e.ts.tv_sec;
+		tv.tv_usec = e.ts.tv_nsec / 1000;
+
+		win = check_window(&tv);
+		if (win == 1)
+			continue;
+		if (win == 2) {
+			ret = 0;
+			break;
+		}
+
+		lf = new_logframe();
+		if (!lf)
+			break;
+
+		lf->asgn = lookup_asgn(e.ifname, socket, assignments, verbose);
+		if (lf->asgn == -2)
+			break;
+		if (lf->asgn < 0)
+			continue;
+
+		lf->tv = tv;
+		lf->line = NULL;
+		lf->linelen = 0;
+		lf->mtu = e.mtu;
+		lf->frame = e.frame;
+		nframes++;
+	}
+
+	binlog_close(&bl);
+
+	if (ret < 0)
+		fprintf(stderr, "broken or truncated binary logfile\n");
+
+	return (ret != 0);
+}
+
+/* find the first frame line at or after 'off' for the seek index */
+static int read_seekidx_entry(int fd, long long off, struct seekidx *e)
+{
+	char buf[INDEX_CHUNK];
+	char *p, *end, *nl;
+	unsigned long long sec, usec;
+	ssize_t n;
+
+	n = pread(fd, buf, sizeof(buf) - 1, off);
+	if (n <= 0)
+		return 1;
+	buf[n] = 0;
+
+	p = buf;
+	if (off) {
+		/* skip the (partial) line we are pointing into */
+		p = memchr(buf, '\n', n);
+		if (!p)
+			return 1;
+		p++;
+	}
+
+	for (; p < buf + n; p = nl + 1) {
+		if (p[0] == '(') {
+			sec = strtoull(p + 1, &end, 10);
+			if (*end == '.') {
+				usec = strtoull(end + 1, &end, 10);
+				if (*end == ')') {
+					e->us = sec * 1000000ULL + usec;
+					e->offset = off + (p - buf);
+					return 0;
+				}
+			}
+		}
+
+		nl = memchr(p, '\n', buf + n - p);
+		if (!nl)
+			break;
+	}
+
+	return 1;
+}
+
+static int load_seekidx(const char *idxname, struct stat *st)
+{
+	FILE *f = fopen(idxname, "r");
+	struct seekidx e;
+	long long size, mtime;
+	unsigned long long sec, usec;
+	unsigned long max = 0;
+	struct seekidx *new;
+	int step;
+
+	if (!f)
+		return 1;
+
+	/* the index is only valid for the logfile it has been created for */
+	if (fscanf(f, "canplayer seek index: size %lld mtime %lld step %d\n",
+		   &size, &mtime, &step) != 3 ||
+	    size != (long long)st->st_size || mtime != (long long)st->st_mtime) {
+		fclose(f);
+		return 1;
+	}
+
+	while (fscanf(f, "%llu.%llu %lld\n", &sec, &usec, &e.offset) == 3) {
+		e.us = sec * 1000000ULL + usec;
+		if (seekidx_cnt == max) {
+			max = (max) ? max * 2 : 1024;
+			new = realloc(seekidx, max * sizeof(*seekidx));
+			if (!new)
+				break;
+			seekidx = new;
+		}
+		seekidx[seekidx_cnt++] = e;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static void save_seekidx(const char *idxname, struct stat *st)
+{
+	FILE *f = fopen(idxname, "w");
+	unsigned long i;
+
+	if (!f)
+		return; /* e.g. read-only directory - create the index next time again */
+
+	fprintf(f, "canplayer seek index: size %lld mtime %lld step %d\n",
+		(long long)st->st_size, (long long)st->st_mtime, INDEX_STEP);
+
+	for (i = 0; i < seekidx_cnt; i++)
+		fprintf(f, "%llu.%06llu %lld\n", seekidx[i].us / 1000000,
+			seekidx[i].us % 1000000, seekidx[i].offset);
+
+	if (fclose(f))
+		unlink(idxname);
+}
+
+/*
+ * Create the sparse seek index for the text logfile 'infile'. Only one
+ * chunk of the logfile is read per INDEX_STEP bytes. The index is loaded
+ * from and stored to a '<infile>.idx' sidecar file if possible.
+ */
+static int setup_seekidx(FILE *infile, const char *infilename, int verbose)
+{
+	char idxname[PATH_MAX];
+	struct seekidx e;
+	struct stat st;
+	long long off;
+	int fd = fileno(infile);
+
+	if (fstat(fd, &st) < 0) {
+		perror("fstat");
+		return 1;
+	}
+
+	if (!S_ISREG(st.st_mode))
+		return 0; /* process the window linearly */
+
+	if (snprintf(idxname, sizeof(idxname), "%s.idx", infilename) >= (int)sizeof(idxname))
+		idxname[0] = 0;
+
+	if (idxname[0] && !load_seekidx(idxname, &st)) {
+		if (verbose > 1) /* use -v -v to see this */
+			printf("loaded %lu seek index entries from %s\n", seekidx_cnt, idxname);
+		return 0;
+	}
+
+	seekidx = malloc((st.st_size / INDEX_STEP + 1) * sizeof(*seekidx));
+	if (!seekidx) {
+		perror("malloc");
+		return 1;
+	}
+
+	for (off = 0; off < st.st_size; off += INDEX_STEP) {
+		if (!read_seekidx_entry(fd, off, &e))
+			seekidx[seekidx_cnt++] = e;
+	}
+
+	if (verbose > 1) /* use -v -v to see this */
+		printf("created %lu seek index entries\n", seekidx_cnt);
+
+	if (idxname[0])
+		save_seekidx(idxname, &st);
+
+	return 0;
+}
+
+/* file offset to start reading the logfile for the replay time window */
+static long long window_offset(void)
+{
+	unsigned long lo = 0, hi, mid;
+
+	if (!seekidx_cnt)
+		return 0;
+
+	if (win_rel)
+		resolve_window(seekidx[0].us);
+
+	/* find the last index entry before the window start */
+	hi = seekidx_cnt;
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (seekidx[mid].us < win_start)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return seekidx[lo].offset;
+}
+
+/*
+ * Map the logfile and parse all frames into the frames[] array once.
+ * The mapping is kept to print the original lines for the stdout hook.
+ */
+static int load_logfile(FILE *infile, int socket, int assignments, int verbose)
+{
+	static char buf[BUFSZ];
+	struct logframe *lf;
+	struct stat st;
+	char *p, *end, *nl;
+	size_t linelen;
+	int ret;
+
+	if (fstat(fileno(infile), &st) < 0) {
+		perror("fstat");
+		return 1;
+	}
+
+	if (!S_ISREG(st.st_mode)) {
+		fprintf(stderr, "infile needs to be a regular file for pre-parsing\n");
+		return 1;
+	}
+
+	if (!st.st_size)
+		return 0; /* nothing to replay */
+
+	mapsz = st.st_size;
+	map = mmap(NULL, mapsz, PROT_READ, MAP_PRIVATE, fileno(infile), 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		map = NULL;
+		return 1;
+	}
+	madvise(map, mapsz, MADV_SEQUENTIAL);
+
+	if ((mapsz >= BINLOG_HDRSZ) && !memcmp(map, BINLOG_MAGIC, sizeof(BINLOG_MAGIC))) {
+		munmap(map, mapsz);
+		map = NULL;
+		return load_binlog(infile, socket, assignments, verbose);
+	}
+
+	/* avoid some reallocs for big logfiles */
+	maxframes = mapsz / AVG_LINESZ + 1;
+	frames = malloc(maxframes * sizeof(*frames));
+	if (!frames) {
+		perror("malloc");
+		return 1;
+	}
+
+	for (p = map + window_offset(), end = map + mapsz; p < end; p += linelen) {
+
+		nl = memchr(p, '\n', end - p);
+		linelen = (nl) ? nl - p + 1 : end - p;
+
+		if (p[0] != '(')
+			continue; /* comment line */
+
+		if (linelen >= BUFSZ) {
+			fprintf(stderr, "line too long for input buffer\n");
+			return 1;
+		}
+
+		/* the mapping is not null terminated */
+		memcpy(buf, p, linelen);
+		buf[linelen] = 0;
+
+		lf = new_logframe();
+		if (!lf)
+			return 1;
+
+		ret = parse_logline(buf, lf, socket, assignments, verbose);
+		if (ret < 0)
+			return 1;
+		if (ret == 2)
+			break; /* end of the time window */
+		if (ret)
+			continue;
+
+		lf->line = p;
+		lf->linelen = linelen;
+		nframes++;
+	}
+
+	return 0;
+}
+
+/*
+ * Get the next frame to be replayed from the pre-parsed frames[] array
+ * or read it from the infile. Returns 1 for a valid frame, 0 on EOF and
+ * -1 on errors.
+ */
+static int next_logframe(FILE *infile, unsigned long *pos, struct logframe **lfp,
+			 int socket, int assignments, int verbose)
+{
+	static char buf[BUFSZ];
+	static struct logframe lf;
+	char *fret;
+	int ret;
+
+	if (preparse) {
+		if (*pos >= nframes)
+			return 0;
+		*lfp = &frames[(*pos)++];
+		return 1;
+	}
+
+	while (1) {
+		/* read next non-comment frame from logfile */
+		while ((fret = fgets(buf, BUFSZ-1, infile)) != NULL && buf[0] != '(') {
+			if (strlen(buf) >= BUFSZ-2) {
+				fprintf(stderr, "comment line too long for input buffer\n");
+				return -1;
+			}
+		}
+
+		if (!fret)
+			return 0; /* nothing to read */
+
+		ret = parse_logline(buf, &lf, socket, assignments, verbose);
+		if (ret < 0)
+			return -1;
+		if (ret == 2)
+			return 0; /* end of the time window */
+		if (!ret)
+			break;
+	}
+
+	lf.line = buf;
+	lf.linelen = strlen(buf);
+	*lfp = &lf;
+
+	return 1;
+}
+
+static int send_logframe(int s, struct logframe *lf, int verbose)
+{
+	struct assignment *a = &asgn[lf->asgn];
+	struct sockaddr_can addr;
+	char cfbuf[CL_CFSZ];
+
+	if (a->txifidx == STDOUTIDX) { /* hook to print logfile lines on stdout */
+
+		if (lf->line) /* print the line AS-IS without extra \n */
+			fwrite(lf->line, 1, lf->linelen, stdout);
+		else {
+			sprint_canframe(cfbuf, &lf->frame, 0,
+					(lf->mtu == CANFD_MTU) ? CANFD_MAX_DLEN : CAN_MAX_DLEN);
+			printf("(%010lu.%06lu) %s %s\n", (unsigned long)lf->tv.tv_sec,
+			       (unsigned long)lf->tv.tv_usec, a->rxif, cfbuf);
+		}
+		fflush(stdout);
+		return 0;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family  = AF_CAN;
+	addr.can_ifindex = a->txifidx; /* send via this interface */
+
+	if (sendto(s, &lf->frame, lf->mtu, 0, (struct sockaddr*)&addr, sizeof(addr)) != lf->mtu) {
+		perror("sendto");
+		return 1;
+	}
+
+	if (verbose) {
+		printf("%s (%s) ", a->txif, a->rxif);
+
+		if (lf->mtu == CAN_MTU)
+			fprint_long_canframe(stdout, &lf->frame, "\n", CANLIB_VIEW_INDENT_SFF, CAN_MAX_DLEN);
+		else
+			fprint_long_canframe(stdout, &lf->frame, "\n", CANLIB_VIEW_INDENT_SFF, CANFD_MAX_DLEN);
+	}
+
+	return 0;
+}
+
+static inline unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline unsigned long long tv2ns(struct timeval *tv)
+{
+	return tv->tv_sec * 1000000000ULL + tv->tv_usec * 1000ULL;
+}
+
+/* replay time for the logfile time 'log_ns' since 'epoch_log' */
+static inline unsigned long long scale_ns(unsigned long long log_ns,
+					  unsigned long long epoch_log, double speed)
+{
+	/* small backward jumps in the logfile are sent immediately */
+	if (log_ns < epoch_log)
+		return 0;
+
+	if (speed == 1.0)
+		return log_ns - epoch_log;
+
+	return (log_ns - epoch_log) / speed;
+}
+
+/*
+ * Sleep until the absolute CLOCK_MONOTONIC deadline. The last 'busywait'
+ * nano seconds are spent polling the clock to compensate the wakeup latency.
+ * Returns the current time.
+ */
+static unsigned long long wait_deadline(unsigned long long deadline,
+					unsigned long long busywait)
+{
+	unsigned long long now = now_ns();
+	struct timespec ts;
+
+	if (deadline > now + busywait) {
+		ts.tv_sec = (deadline - busywait) / 1000000000ULL;
+		ts.tv_nsec = (deadline - busywait) % 1000000000ULL;
+
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR &&
+		       running)
+			;
+
+		now = now_ns();
+	}
+
+	while (now < deadline && running)
+		now = now_ns();
+
+	return now;
+}
+
+static inline void add_timing_error(struct sender *sd, unsigned long long now,
+				    unsigned long long deadline)
+{
+	unsigned long long err = (now > deadline) ? now - deadline : 0;
+	unsigned long long us = err / 1000;
+
+	sd->err_cnt++;
+	sd->err_sum += err;
+	if (err > sd->err_max)
+		sd->err_max = err;
+
+	sd->err_hist[(us < ERRHISTSZ) ? us : ERRHISTSZ]++;
+}
+
+static void merge_timing_stats(struct sender *to, struct sender *from)
+{
+	int i;
+
+	to->err_cnt += from->err_cnt;
+	to->err_sum += from->err_sum;
+	if (from->err_max > to->err_max)
+		to->err_max = from->err_max;
+	for (i = 0; i <= ERRHISTSZ; i++)
+		to->err_hist[i] += from->err_hist[i];
+	to->enobufs_count += from->enobufs_count;
+}
+
+static void print_timing_stats(struct sender *sd, const char *name)
+{
+	unsigned long long sum = 0;
+	unsigned long i;
+
+	if (!sd->err_cnt)
+		return;
+
+	/* first histogram bucket that exceeds 99% of all frames */
+	for (i = 0; i < ERRHISTSZ; i++) {
+		sum += sd->err_hist[i];
+		if (sum * 100 >= sd->err_cnt * 99)
+			break;
+	}
+
+	fprintf(stderr, "timing error%s%s: %llu frames, mean %.1f us, p99 %s%lu us, max %.1f us, %lu ENOBUFS\n",
+		(name) ? " " : "", (name) ? name : "",
+		sd->err_cnt, (double)sd->err_sum / sd->err_cnt / 1000, (i == ERRHISTSZ) ? ">" : "<",
+		(i == ERRHISTSZ) ? i : i + 1, (double)sd->err_max / 1000, sd->enobufs_count);
+}
+
+/* collect the frames that are due at the same time for one sendmmsg() */
+static void batch_init(struct sender *sd)
+{
+	int i;
+
+	for (i = 0; i < BATCHSZ; i++) {
+		sd->slot[i].iov.iov_base = &sd->slot[i].frame;
+		sd->msg[i].msg_hdr.msg_name = &sd->slot[i].addr;
+		sd->msg[i].msg_hdr.msg_namelen = sizeof(sd->slot[i].addr);
+		sd->msg[i].msg_hdr.msg_iov = &sd->slot[i].iov;
+		sd->msg[i].msg_hdr.msg_iovlen = 1;
+	}
+}
 
-	/* create diff_tv so that log_tv + diff_tv = today_tv */
-	diff->tv_sec  = today->tv_sec  - log->tv_sec;
-	diff->tv_usec = today->tv_usec - log->tv_usec;
+static inline void batch_add(struct sender *sd, struct logframe *lf,
+			     unsigned long long deadline)
+{
+	struct txslot *t = &sd->slot[sd->txcnt++];
+
+	/* copy the frame as lf is re-used when reading from stdin */
+	memcpy(&t->frame, &lf->frame, lf->mtu);
+	t->addr.can_family = AF_CAN;
+	t->addr.can_ifindex = asgn[lf->asgn].txifidx;
+	t->iov.iov_len = lf->mtu;
+	t->asgn = lf->asgn;
+	t->deadline = deadline;
 }
 
-static inline int frames_to_send(struct timeval *today, struct timeval *diff,
-				 struct timeval *log)
+static int batch_flush(struct sender *sd, int verbose, int use_timestamps)
 {
-	/* return value <0 when log + diff < today */
+	char cfbuf[CL_LONGCFSZ];
+	struct txslot *t;
+	unsigned long long now, stuck = 0;
+	int backoff = POLL_MIN;
+	int sent = 0;
+	int i, ret;
+
+	while (sent < sd->txcnt) {
+		ret = sendmmsg(sd->s, &sd->msg[sent], sd->txcnt - sent, 0);
+		if (ret < 0) {
+			if (errno == EINTR && running)
+				continue;
+
+			if (errno != ENOBUFS) {
+				if (running)
+					perror("sendmmsg");
+				return running;
+			}
 
-	struct timeval cmp;
+			/* give up when the queue does not drain (e.g. bus-off) */
+			if (!stuck)
+				stuck = now_ns();
+			else if (now_ns() - stuck > ENOBUFS_TIMEOUT * 1000000ULL) {
+				perror("sendmmsg");
+				return 1;
+			}
 
-	cmp.tv_sec  = log->tv_sec  + diff->tv_sec;
-	cmp.tv_usec = log->tv_usec + diff->tv_usec;
+			/*
+			 * The CAN netdev queue is full. POLLOUT does not reflect
+			 * the queue state for CAN_RAW sockets - so back off with
+			 * increasing timeouts until the queue has drained.
+			 */
+			sd->enobufs_count++;
+			poll(NULL, 0, backoff);
+			if (!running)
+				return 0;
+			if (backoff < POLL_MAX)
+				backoff *= 2;
+			continue;
+		}
 
-	if (cmp.tv_usec > 1000000) {
-		cmp.tv_usec -= 1000000;
-		cmp.tv_sec++;
+		/* the frames of this chunk left including all backoff delays */
+		if (use_timestamps) {
+			now = now_ns();
+			for (i = sent; i < sent + ret; i++)
+				add_timing_error(sd, now, sd->slot[i].deadline);
+		}
+
+		sent += ret;
+		backoff = POLL_MIN;
+		stuck = 0;
 	}
 
-	if (cmp.tv_usec < 0) {
-		cmp.tv_usec += 1000000;
-		cmp.tv_sec--;
+	for (i = 0; verbose && i < sd->txcnt; i++) {
+		t = &sd->slot[i];
+
+		/* one printf() to not mix up the lines of the sender threads */
+		sprint_long_canframe(cfbuf, &t->frame, CANLIB_VIEW_INDENT_SFF,
+				     (t->iov.iov_len == CAN_MTU) ? CAN_MAX_DLEN : CANFD_MAX_DLEN);
+		printf("%s (%s) %s\n", asgn[t->asgn].txif, asgn[t->asgn].rxif, cfbuf);
 	}
 
-	return timeval_compare(&cmp, today);
+	sd->txcnt = 0;
+	return 0;
 }
 
-int get_txidx(char *logif_name) {
+/*
+ * Replay the frames of one loop starting with 'lf' at absolute deadlines
+ * that are derived from the logfile timestamps. All frames that are due
+ * at the time of sending are sent in one sendmmsg() batch. Without
+ * timestamps (-t) all frames are due immediately.
+ */
+static int replay_deadlines(FILE *infile, unsigned long *pos, struct logframe *lf,
+			    struct sender *sd, int assignments, int verbose, int use_timestamps,
+			    unsigned long skipgap, unsigned long long busywait,
+			    double speed)
+{
+	unsigned long long log_ns, deadline = 0, now;
+	unsigned long long epoch_now, epoch_log; /* corresponding points in time */
+	time_t last_log_sec;
+	int ret;
+
+	now = now_ns();
+	epoch_now = now;
+	epoch_log = tv2ns(&lf->tv);
+	last_log_sec = lf->tv.tv_sec;
+
+	while (running) {
+
+		if (use_timestamps) {
+			log_ns = tv2ns(&lf->tv);
+
+			/* test for logfile timestamps jumping backwards OR      */
+			/* if the user likes to skip long gaps in the timestamps */
+			if ((last_log_sec > lf->tv.tv_sec) ||
+			    (skipgap && labs(last_log_sec - lf->tv.tv_sec) > (long)skipgap)) {
+				now = now_ns();
+				epoch_now = now;
+				epoch_log = log_ns;
+			}
+
+			last_log_sec = lf->tv.tv_sec;
 
-	int i;
+			deadline = epoch_now + scale_ns(log_ns, epoch_log, speed);
+		}
 
-	for (i=0; i<CHANNELS; i++) {
-		if (asgn[i].rxif[0] == 0) /* end of table content */
-			break;
-		if (strcmp(asgn[i].rxif, logif_name) == 0) /* found device name */
+		if (deadline > now) {
+			/* send the frames that are already due before sleeping */
+			if (sd->txcnt && batch_flush(sd, verbose, use_timestamps))
+				return 1;
+
+			now = wait_deadline(deadline, busywait);
+			if (!running)
+				break;
+		}
+
+		if (asgn[lf->asgn].txifidx == STDOUTIDX) {
+			/* keep the order of printed lines and sent frames */
+			if (sd->txcnt && batch_flush(sd, verbose, use_timestamps))
+				return 1;
+			if (send_logframe(sd->s, lf, verbose))
+				return 1;
+		} else {
+			batch_add(sd, lf, deadline);
+			if (sd->txcnt == BATCHSZ && batch_flush(sd, verbose, use_timestamps))
+				return 1;
+		}
+
+		/* read next frame from logfile */
+		ret = next_logframe(infile, pos, &lf, sd->s, assignments, verbose);
+		if (ret < 0)
+			return 1;
+		if (!ret)
 			break;
 	}
 
-	if ((i == CHANNELS) || (asgn[i].rxif[0] == 0))
-		return 0; /* not found */
+	if (sd->txcnt && batch_flush(sd, verbose, use_timestamps))
+		return 1;
 
-	return asgn[i].txifidx; /* return interface index */
+	return 0;
 }
 
-char *get_txname(char *logif_name) {
+static int open_socket(int loopback_disable)
+{
+	struct sockaddr_can addr;
+	int s;
 
-	int i;
+	if ((s = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
+		perror("socket");
+		return -1;
+	}
 
-	for (i=0; i<CHANNELS; i++) {
-		if (asgn[i].rxif[0] == 0) /* end of table content */
-			break;
-		if (strcmp(asgn[i].rxif, logif_name) == 0) /* found device name */
-			break;
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family  = AF_CAN;
+	addr.can_ifindex = 0;
+
+	/* disable unneeded default receive filter on this RAW socket */
+	setsockopt(s, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
+
+	/* try to switch the socket into CAN FD mode */
+	setsockopt(s, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &canfd_on, sizeof(canfd_on));
+
+	if (loopback_disable) {
+		int loopback = 0;
+
+		setsockopt(s, SOL_CAN_RAW, CAN_RAW_LOOPBACK,
+			   &loopback, sizeof(loopback));
 	}
 
-	if ((i == CHANNELS) || (asgn[i].rxif[0] == 0))
-		return 0; /* not found */
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		close(s);
+		return -1;
+	}
 
-	return asgn[i].txif; /* return interface name */
+	return s;
 }
 
-int add_assignment(char *mode, int socket, char *txname, char *rxname,
-		   int verbose) {
+/*
+ * Calculate the deadlines of all pre-parsed frames relative to the common
+ * replay start, so that the sender threads do not depend on each other.
+ * Jumps in the logfile time rebase the timeline on the previous frame.
+ */
+static void create_timeline(int use_timestamps, unsigned long skipgap, double speed)
+{
+	unsigned long long log_ns, epoch_log, epoch_rel = 0, rel = 0;
+	time_t last_log_sec;
+	unsigned long i;
 
-	struct ifreq ifr;
-	int i;
+	if (!nframes)
+		return;
 
-	/* find free entry */
-	for (i=0; i<CHANNELS; i++) {
-		if (asgn[i].txif[0] == 0)
-			break;
-	}
+	epoch_log = tv2ns(&frames[0].tv);
+	last_log_sec = frames[0].tv.tv_sec;
 
-	if (i == CHANNELS) {
-		fprintf(stderr, "Assignment table exceeded!\n");
-		return 1;
+	for (i = 0; i < nframes; i++) {
+
+		if (use_timestamps) {
+			log_ns = tv2ns(&frames[i].tv);
+
+			if ((last_log_sec > frames[i].tv.tv_sec) ||
+			    (skipgap && labs(last_log_sec - frames[i].tv.tv_sec) > (long)skipgap)) {
+				epoch_rel = rel;
+				epoch_log = log_ns;
+			}
+
+			last_log_sec = frames[i].tv.tv_sec;
+			rel = epoch_rel + scale_ns(log_ns, epoch_log, speed);
+		}
+
+		frames[i].rel_ns = rel;
 	}
 
-	if (strlen(txname) >= IFNAMSIZ) {
-		fprintf(stderr, "write-if interface name '%s' too long!", txname);
+	/* the next loop starts with the last frame of the previous loop */
+	par_looplen = rel;
+}
+
+/* distribute the pre-parsed frames to one sender per tx interface */
+static int create_senders(int loopback_disable)
+{
+	struct sender *sd;
+	int *asgn2sender;
+	unsigned long i;
+	int a, j;
+
+	asgn2sender = malloc(asgn_cnt * sizeof(*asgn2sender));
+	senders = calloc(asgn_cnt, sizeof(*senders));
+	if (!asgn2sender || !senders) {
+		perror("malloc");
 		return 1;
 	}
-	strcpy(asgn[i].txif, txname);
 
-	if (strlen(rxname) >= IFNAMSIZ) {
-		fprintf(stderr, "log-if interface name '%s' too long!", rxname);
-		return 1;
+	/* several log interfaces may be assigned to the same tx interface */
+	for (a = 0; a < asgn_cnt; a++) {
+		for (j = 0; j < nsenders; j++) {
+			if (senders[j].txifidx == asgn[a].txifidx)
+				break;
+		}
+
+		if (j == nsenders) {
+			sd = &senders[nsenders++];
+			sd->txifidx = asgn[a].txifidx;
+			sd->name = asgn[a].txif;
+			sd->s = -1;
+			batch_init(sd);
+		}
+		asgn2sender[a] = j;
 	}
-	strcpy(asgn[i].rxif, rxname);
 
-	if (strcmp(txname, "stdout")) {
-		strcpy(ifr.ifr_name, txname);
-		if (ioctl(socket, SIOCGIFINDEX, &ifr) < 0) {
-			perror("SIOCGIFINDEX");
-			fprintf(stderr, "write-if interface name '%s' is wrong!\n", txname);
+	for (i = 0; i < nframes; i++)
+		senders[asgn2sender[frames[i].asgn]].cnt++;
+
+	for (j = 0; j < nsenders; j++) {
+		sd = &senders[j];
+		sd->idx = malloc((sd->cnt + 1) * sizeof(*sd->idx));
+		if (!sd->idx) {
+			perror("malloc");
 			return 1;
 		}
-		asgn[i].txifidx = ifr.ifr_ifindex;
-	} else
-		asgn[i].txifidx = STDOUTIDX;
+		sd->cnt = 0;
 
-	if (verbose > 1) /* use -v -v to see this */
-		printf("added %s assignment: log-if=%s write-if=%s write-if-idx=%d\n",
-		       mode, asgn[i].rxif, asgn[i].txif, asgn[i].txifidx);
+		if (sd->txifidx != STDOUTIDX) {
+			sd->s = open_socket(loopback_disable);
+			if (sd->s < 0)
+				return 1;
+		}
+	}
+
+	for (i = 0; i < nframes; i++) {
+		sd = &senders[asgn2sender[frames[i].asgn]];
+		sd->idx[sd->cnt++] = i;
+	}
 
+	free(asgn2sender);
 	return 0;
 }
 
+static void *sender_thread(void *arg)
+{
+	struct sender *sd = arg;
+	struct logframe *lf;
+	unsigned long long loop_epoch = par_epoch, deadline = 0, now = 0;
+	unsigned long i;
+	int loop;
+
+	for (loop = 0; running && (par_loops < 0 || loop < par_loops); loop++) {
+
+		for (i = 0; i < sd->cnt && running; i++) {
+			lf = &frames[sd->idx[i]];
+
+			if (par_use_timestamps)
+				deadline = loop_epoch + lf->rel_ns;
+
+			if (deadline > now) {
+				if (sd->txcnt && batch_flush(sd, par_verbose, par_use_timestamps))
+					goto error;
+
+				now = wait_deadline(deadline, par_busywait);
+				if (!running)
+					break;
+			}
+
+			if (sd->txifidx == STDOUTIDX) {
+				if (send_logframe(sd->s, lf, par_verbose))
+					goto error;
+			} else {
+				batch_add(sd, lf, deadline);
+				if (sd->txcnt == BATCHSZ &&
+				    batch_flush(sd, par_verbose, par_use_timestamps))
+					goto error;
+			}
+		}
+
+		if (sd->txcnt && batch_flush(sd, par_verbose, par_use_timestamps))
+			goto error;
+
+		loop_epoch += par_looplen;
+	}
+
+	return NULL;
+
+error:
+	sd->err = 1;
+	running = 0; /* stop the other threads too */
+	return NULL;
+}
+
+/* replay the pre-parsed frames with one thread per tx interface (-p) */
+static int replay_parallel(int loopback_disable, int loops, int verbose,
+			   int use_timestamps, unsigned long skipgap,
+			   unsigned long long busywait, double speed)
+{
+	int i, err = 0;
+
+	create_timeline(use_timestamps, skipgap, speed);
+
+	if (create_senders(loopback_disable))
+		return 1;
+
+	par_loops = loops;
+	par_verbose = verbose;
+	par_use_timestamps = use_timestamps;
+	par_busywait = busywait;
+
+	/* give all threads the time to get ready for the first deadline */
+	par_epoch = now_ns() + START_DELAY;
+
+	for (i = 0; i < nsenders; i++) {
+		if (pthread_create(&senders[i].thread, NULL, sender_thread, &senders[i])) {
+			perror("pthread_create");
+			running = 0;
+			nsenders = i;
+			err = 1;
+			break;
+		}
+	}
+
+	for (i = 0; i < nsenders; i++) {
+		pthread_join(senders[i].thread, NULL);
+		err |= senders[i].err;
+		merge_timing_stats(&main_sender, &senders[i]);
+		if (senders[i].s >= 0)
+			close(senders[i].s);
+	}
+
+	return err;
+}
+
 int main(int argc, char **argv)
 {
-	static char buf[BUFSZ], device[BUFSZ], ascframe[BUFSZ];
-	struct sockaddr_can addr;
-	static struct canfd_frame frame;
-	static struct timeval today_tv, log_tv, last_log_tv, diff_tv;
+	static char buf[BUFSZ];
+	static struct timeval today_tv, last_log_tv, diff_tv;
 	struct timespec sleep_ts;
+	struct logframe *lf;
 	int s; /* CAN_RAW socket */
 	FILE *infile = stdin;
 	unsigned long gap = DEFAULT_GAP; 
+	unsigned long pos;
+	unsigned long long busywait = 0;
+	double speed = 1.0;
+	char *infilename = NULL;
+	char *stop;
+	int binary = 0;
 	int use_timestamps = 1;
+	int use_gap = 0;
+	int timing_stats = 0;
+	int parallel = 0;
 	static int verbose, opt, delay_loops;
 	static unsigned long skipgap;
 	static int loopback_disable = 0;
 	static int infinite_loops = 0;
 	static int loops = DEFAULT_LOOPS;
 	int assignments; /* assignments defined on the commandline */
-	int txidx;       /* sendto() interface index */
-	int eof, txmtu, i, j;
-	char *fret;
+	int eof, ret, i, j;
+	char magic[sizeof(BINLOG_MAGIC)];
 
-	while ((opt = getopt(argc, argv, "I:l:tg:s:xv?")) != -1) {
+	while ((opt = getopt(argc, argv, "I:l:mtg:b:Ss:f:w:pxv?")) != -1) {
 		switch (opt) {
 		case 'I':
 			infile = fopen(optarg, "r");
@@ -262,6 +1410,7 @@ int main(int argc, char **argv)
 				perror("infile");
 				return 1;
 			}
+			infilename = optarg;
 			break;
 
 		case 'l':
@@ -274,12 +1423,25 @@ int main(int argc, char **argv)
 				}
 			break;
 
+		case 'm':
+			preparse = 1;
+			break;
+
 		case 't':
 			use_timestamps = 0;
 			break;
 
 		case 'g':
 			gap = strtoul(optarg, NULL, 10);
+			use_gap = 1;
+			break;
+
+		case 'b':
+			busywait = strtoul(optarg, NULL, 10) * 1000ULL;
+			break;
+
+		case 'S':
+			timing_stats = 1;
 			break;
 
 		case 's':
@@ -290,6 +1452,39 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'f':
+			speed = strtod(optarg, NULL);
+			if (speed < MIN_SPEED || speed > MAX_SPEED) {
+				fprintf(stderr, "Invalid argument for option -f !\n");
+				return 1;
+			}
+			break;
+
+		case 'w':
+			/* <start>[,<stop>] - both values are optional */
+			stop = strchr(optarg, ',');
+			if (stop)
+				*stop++ = 0;
+			if (*optarg) {
+				if (*optarg == '+')
+					win_rel |= 1;
+				win_start = strtod(optarg, NULL) * 1000000;
+			}
+			if (stop && *stop) {
+				if (*stop == '+')
+					win_rel |= 2;
+				win_stop = strtod(stop, NULL) * 1000000;
+			}
+			if ((win_rel == 0 || win_rel == 3) && win_start > win_stop) {
+				fprintf(stderr, "Invalid argument for option -w !\n");
+				return 1;
+			}
+			break;
+
+		case 'p':
+			parallel = 1;
+			break;
+
 		case 'x':
 			loopback_disable = 1;
 			break;
@@ -309,8 +1504,35 @@ int main(int argc, char **argv)
 	assignments = argc - optind; /* find real number of user assignments */
 
 	if (infile == stdin) { /* no jokes with stdin */
+		if (parallel) {
+			fprintf(stderr, "Option -p needs an infile!\n");
+			return 1;
+		}
 		infinite_loops = 0;
 		loops = 1;
+		preparse = 0;
+	} else {
+		/* parse the file only once when it is processed several times */
+		if (infinite_loops || loops > 1 || parallel)
+			preparse = 1;
+
+		/* binary logfiles are always loaded into memory */
+		if (fread(magic, sizeof(magic), 1, infile) == 1 &&
+		    !memcmp(magic, BINLOG_MAGIC, sizeof(magic))) {
+			preparse = 1;
+			binary = 1;
+		}
+		rewind(infile);
+
+		/* seek to the window start instead of parsing up to it */
+		if (!binary && (win_start || (win_rel & 1)) &&
+		    setup_seekidx(infile, infilename, verbose))
+			return 1;
+	}
+
+	if ((speed != 1.0 || parallel) && use_gap) {
+		fprintf(stderr, "Options -f and -p can not be used with option -g !\n");
+		return 1;
 	}
 
 	if (verbose > 1) { /* use -v -v to see this */
@@ -323,32 +1545,21 @@ int main(int argc, char **argv)
 	sleep_ts.tv_sec  =  gap / 1000;
 	sleep_ts.tv_nsec = (gap % 1000) * 1000000;
 
-	/* open socket */
-	if ((s = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
-		perror("socket");
-		return 1;
-	}
-
-	addr.can_family  = AF_CAN;
-	addr.can_ifindex = 0;
-
-	/* disable unneeded default receive filter on this RAW socket */
-	setsockopt(s, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0);
-
-	/* try to switch the socket into CAN FD mode */
-	setsockopt(s, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &canfd_on, sizeof(canfd_on));
+	/* the default timer slack of 50us would spoil the absolute deadlines */
+	if (use_timestamps && !use_gap)
+		prctl(PR_SET_TIMERSLACK, 1UL);
 
-	if (loopback_disable) {
-		int loopback = 0;
+	batch_init(&main_sender);
 
-		setsockopt(s, SOL_CAN_RAW, CAN_RAW_LOOPBACK,
-			   &loopback, sizeof(loopback));
-	}
+	signal(SIGTERM, sigterm);
+	signal(SIGHUP, sigterm);
+	signal(SIGINT, sigterm);
 
-	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-		perror("bind");
+	/* open socket */
+	s = open_socket(loopback_disable);
+	if (s < 0)
 		return 1;
-	}
+	main_sender.s = s;
 
 	if (assignments) {
 		/* add & check user assignments from commandline */
@@ -374,136 +1585,96 @@ int main(int argc, char **argv)
 		}
 	}
 
-	while (infinite_loops || loops--) {
-
-		if (infile != stdin)
-			rewind(infile); /* for each loop */
+	if (preparse) {
+		if (load_logfile(infile, s, assignments, verbose))
+			return 1;
 
 		if (verbose > 1) /* use -v -v to see this */
-			printf (">>>>>>>>> start reading file. remaining loops = %d\n", loops);
+			printf("pre-parsed %lu frames\n", nframes);
+	}
 
-		/* read first non-comment frame from logfile */
-		while ((fret = fgets(buf, BUFSZ-1, infile)) != NULL && buf[0] != '(') {
-			if (strlen(buf) >= BUFSZ-2) {
-				fprintf(stderr, "comment line too long for input buffer\n");
-				return 1;
-			}
+	if (parallel) {
+		if (replay_parallel(loopback_disable, (infinite_loops) ? -1 : loops,
+				    verbose, use_timestamps, skipgap, busywait, speed))
+			return 1;
+
+		if (timing_stats) {
+			for (i = 0; i < nsenders; i++)
+				print_timing_stats(&senders[i], senders[i].name);
 		}
+		goto out;
+	}
 
-		if (!fret)
-			goto out; /* nothing to read */
+	while (running && (infinite_loops || loops--)) {
 
-		eof = 0;
+		if (infile != stdin && !preparse)
+			fseeko(infile, window_offset(), SEEK_SET); /* for each loop */
 
-		if (sscanf(buf, "(%lu.%lu) %s %s", &log_tv.tv_sec, &log_tv.tv_usec,
-			   device, ascframe) != 4) {
-			fprintf(stderr, "incorrect line format in logfile\n");
+		if (verbose > 1) /* use -v -v to see this */
+			printf (">>>>>>>>> start reading file. remaining loops = %d\n", loops);
+
+		pos = 0;
+
+		/* read first frame from logfile */
+		ret = next_logframe(infile, &pos, &lf, s, assignments, verbose);
+		if (ret < 0)
 			return 1;
+		if (!ret)
+			goto out; /* nothing to read */
+
+		if (!use_timestamps || !use_gap) {
+			if (replay_deadlines(infile, &pos, lf, &main_sender, assignments, verbose,
+					     use_timestamps, skipgap, busywait, speed))
+				return 1;
+			continue;
 		}
 
+		eof = 0;
+
 		if (use_timestamps) { /* throttle sending due to logfile timestamps */
 
 			gettimeofday(&today_tv, NULL);
-			create_diff_tv(&today_tv, &diff_tv, &log_tv);
-			last_log_tv = log_tv;
+			create_diff_tv(&today_tv, &diff_tv, &lf->tv);
+			last_log_tv = lf->tv;
 		}
 
-		while (!eof) {
+		while (!eof && running) {
 
 			while ((!use_timestamps) ||
-			       (frames_to_send(&today_tv, &diff_tv, &log_tv) < 0)) {
+			       (frames_to_send(&today_tv, &diff_tv, &lf->tv) < 0)) {
 
-				/* log_tv/device/ascframe are valid here */
+				/* lf is valid here */
 
-				if (strlen(device) >= IFNAMSIZ) {
-					fprintf(stderr, "log interface name '%s' too long!", device);
+				if (send_logframe(s, lf, verbose))
 					return 1;
-				}
-
-				txidx = get_txidx(device); /* get ifindex for sending the frame */
- 
-				if ((!txidx) && (!assignments)) {
-					/* ifindex not found and no user assignments */
-					/* => assign this device automatically       */
-					if (add_assignment("auto", s, device, device, verbose))
-						return 1;
-					txidx = get_txidx(device);
-				}
-
-				if (txidx == STDOUTIDX) { /* hook to print logfile lines on stdout */
-
-					printf("%s", buf); /* print the line AS-IS without extra \n */
-					fflush(stdout);
-
-				} else if (txidx > 0) { /* only send to valid CAN devices */
-
-					txmtu = parse_canframe(ascframe, &frame);
-					if (!txmtu) {
-						fprintf(stderr, "wrong CAN frame format: '%s'!", ascframe);
-						return 1;
-					}
 
-					addr.can_family  = AF_CAN;
-					addr.can_ifindex = txidx; /* send via this interface */
- 
-					if (sendto(s, &frame, txmtu, 0,	(struct sockaddr*)&addr, sizeof(addr)) != txmtu) {
-						perror("sendto");
-						return 1;
-					}
-
-					if (verbose) {
-						printf("%s (%s) ", get_txname(device), device);
-
-						if (txmtu == CAN_MTU)
-							fprint_long_canframe(stdout, &frame, "\n", CANLIB_VIEW_INDENT_SFF, CAN_MAX_DLEN);
-						else
-							fprint_long_canframe(stdout, &frame, "\n", CANLIB_VIEW_INDENT_SFF, CANFD_MAX_DLEN);
-					}
-				}
-
-				/* read next non-comment frame from logfile */
-				while ((fret = fgets(buf, BUFSZ-1, infile)) != NULL && buf[0] != '(') {
-					if (strlen(buf) >= BUFSZ-2) {
-						fprintf(stderr, "comment line too long for input buffer\n");
-						return 1;
-					}
-				}
-
-				if (!fret) {
+				/* read next frame from logfile */
+				ret = next_logframe(infile, &pos, &lf, s, assignments, verbose);
+				if (ret < 0)
+					return 1;
+				if (!ret) {
 					eof = 1; /* this file is completely processed */
 					break;
 				}
 
-				if (sscanf(buf, "(%lu.%lu) %s %s", &log_tv.tv_sec, &log_tv.tv_usec,
-					   device, ascframe) != 4) {
-					fprintf(stderr, "incorrect line format in logfile\n");
-					return 1;
-				}
-
-				/*
-				 * ensure the fractions of seconds are 6 decimal places long to catch
-				 * 3rd party or handcrafted logfiles that treat the timestamp as float
-				 */
-				if (strchr(buf, ')') - strchr(buf, '.') != 7) {
-					fprintf(stderr, "timestamp format in logfile requires 6 decimal places\n");
-					return 1;
-				}
-
 				if (use_timestamps) {
 					gettimeofday(&today_tv, NULL);
 
 					/* test for logfile timestamps jumping backwards OR      */
 					/* if the user likes to skip long gaps in the timestamps */
-					if ((last_log_tv.tv_sec > log_tv.tv_sec) ||
-					    (skipgap && labs(last_log_tv.tv_sec - log_tv.tv_sec) > (long)skipgap))
-						create_diff_tv(&today_tv, &diff_tv, &log_tv);
+					if ((last_log_tv.tv_sec > lf->tv.tv_sec) ||
+					    (skipgap && labs(last_log_tv.tv_sec - lf->tv.tv_sec) > (long)skipgap))
+						create_diff_tv(&today_tv, &diff_tv, &lf->tv);
 
-					last_log_tv = log_tv;
+					last_log_tv = lf->tv;
 				}
 
 			} /* while frames_to_send ... */
 
-			if (nanosleep(&sleep_ts, NULL))
+			if (eof)
+				break;
+
+			if (nanosleep(&sleep_ts, NULL) && running)
 				return 1;
 
 			delay_loops++; /* private statistics */
@@ -511,13 +1682,21 @@ int main(int argc, char **argv)
 
 		} /* while (!eof) */
 
-	} /* while (infinite_loops || loops--) */
+	} /* while (running && (infinite_loops || loops--)) */
 
 out:
 
 	close(s);
 	fclose(infile);
 
+	if (map)
+		munmap(map, mapsz);
+	free(frames);
+	free(seekidx);
+
+	if (timing_stats)
+		print_timing_stats(&main_sender, (parallel) ? "all" : NULL);
+
 	if (verbose > 1) /* use -v -v to see this */
 		printf("%d delay_loops\n", delay_loops);
 
@@ -157,7 +157,6 @@
 #define SOF_TIMESTAMPING_RAW_HARDWARE (1 << 6)
 
 #define MAXSOCK 16    /* max. number of CAN interfaces given on the cmdline */
-#define MAXIFNAMES 30 /* size of receive name index to omit ioctls */
 #define MAXCOL 6      /* number of different colors for colorized output */
 #define ANYDEV "any"  /* name of interface to receive from any CAN interface */
 #define ANL "\r\n"    /* newline in ASC mode */
@@ -187,9 +186,8 @@ const char col_off[] = ATTRESET;
 static char *cmdlinename[MAXSOCK];
 static __u32 dropcnt[MAXSOCK];
 static __u32 last_dropcnt[MAXSOCK];
-static char devname[MAXIFNAMES][IFNAMSIZ + 1];
-static int dindex[MAXIFNAMES];
-static int max_devname_len; /* to prevent frazzled device name output */
+static struct ifcache ifcache; /* interface index to name cache */
+static int max_devname_len;    /* to prevent frazzled device name output */
 const int canfd_on = 1;
 
 #define MAXANI 4
@@ -302,56 +300,12 @@ void sigterm(int signo)
     running = 0;
 }
 
-int idx2dindex(int ifidx, int socket)
+int idx2dindex(int ifidx)
 {
+    int i = ifcache_index(&ifcache, ifidx);
 
-    int i;
-    struct ifreq ifr;
-
-    for (i = 0; i < MAXIFNAMES; i++)
-    {
-        if (dindex[i] == ifidx)
-            return i;
-    }
-
-    /* create new interface index cache entry */
-
-    /* remove index cache zombies first */
-    for (i = 0; i < MAXIFNAMES; i++)
-    {
-        if (dindex[i])
-        {
-            ifr.ifr_ifindex = dindex[i];
-            if (ioctl(socket, SIOCGIFNAME, &ifr) < 0)
-                dindex[i] = 0;
-        }
-    }
-
-    for (i = 0; i < MAXIFNAMES; i++)
-        if (!dindex[i]) /* free entry */
-            break;
-
-    if (i == MAXIFNAMES)
-    {
-        fprintf(stderr, "Interface index cache only supports %d interfaces.\n",
-                MAXIFNAMES);
-        exit(1);
-    }
-
-    dindex[i] = ifidx;
-
-    ifr.ifr_ifindex = ifidx;
-    if (ioctl(socket, SIOCGIFNAME, &ifr) < 0)
-        perror("SIOCGIFNAME");
-
-    if (max_devname_len < (int)strlen(ifr.ifr_name))
-        max_devname_len = strlen(ifr.ifr_name);
-
-    strcpy(devname[i], ifr.ifr_name);
-
-#ifdef DEBUG
-    printf("new index %d (%s)\n", i, devname[i]);
-#endif
+    if (max_devname_len < ifcache.max_len)
+        max_devname_len = ifcache.max_len;
 
     return i;
 }
@@ -825,6 +779,12 @@ int main(int argc, char **argv)
         }
     }
 
+    if (ifcache_open(&ifcache, s[0]))
+    {
+        fprintf(stderr, "Failed to create interface name cache!\n");
+        return 1;
+    }
+
     if (log) // Changed to function call for
     {
         int logOpened;
@@ -859,16 +819,24 @@ int main(int argc, char **argv)
         for (i = 0; i < currmax; i++)
             FD_SET(s[i], &rdfs);
 
+        /* the netlink socket is created after the CAN sockets */
+        if (ifcache.nl >= 0)
+            FD_SET(ifcache.nl, &rdfs);
+
         if (timeout_current)
             *timeout_current = timeout_config;
 
-        if ((ret = select(s[currmax - 1] + 1, &rdfs, NULL, NULL, timeout_current)) <= 0)
+        if ((ret = select(((ifcache.nl >= 0) ? ifcache.nl : s[currmax - 1]) + 1,
+                          &rdfs, NULL, NULL, timeout_current)) <= 0)
         {
             //perror("select");
             running = 0;
             continue;
         }
 
+        if (ifcache.nl >= 0 && FD_ISSET(ifcache.nl, &rdfs))
+            ifcache_update(&ifcache);
+
         if (0 <= uart_fd)
         {
             if (0 < (uart_buffer_size = read(uart_fd, uart_buffer, sizeof(uart_buffer))))
@@ -917,13 +885,13 @@ int main(int argc, char **argv)
                 msg.msg_flags = 0;
 
                 nbytes = recvmsg(s[i], &msg, 0);
-                idx = idx2dindex(addr.can_ifindex, s[i]);
+                idx = idx2dindex(addr.can_ifindex);
 
                 if (nbytes < 0)
                 {
                     if ((errno == ENETDOWN) && !down_causes_exit)
                     {
-                        fprintf(stderr, "%s: interface down\n", devname[idx]);
+                        fprintf(stderr, "%s: interface down\n", ifcache.entry[idx].name);
                         continue;
                     }
                     perror("read");
@@ -978,11 +946,11 @@ int main(int argc, char **argv)
 
                     if (silent != SILENT_ON)
                         printf("DROPCOUNT: dropped %d CAN frame%s on '%s' socket (total drops %d)\n",
-                               frames, (frames > 1) ? "s" : "", devname[idx], dropcnt[i]);
+                               frames, (frames > 1) ? "s" : "", ifcache.entry[idx].name, dropcnt[i]);
 
                     if (log)
                         fprintf(logfile, "DROPCOUNT: dropped %d CAN frame%s on '%s' socket (total drops %d)\n",
-                                frames, (frames > 1) ? "s" : "", devname[idx], dropcnt[i]);
+                                frames, (frames > 1) ? "s" : "", ifcache.entry[idx].name, dropcnt[i]);
 
                     last_dropcnt[i] = dropcnt[i];
                 }
@@ -1007,7 +975,7 @@ int main(int argc, char **argv)
                     sprint_canframe(buf, &frame, 0, maxdlen);
                     fprintf(logfile, "(%010lu.%06lu) %*s %s%s\n",
                             tv.tv_sec, tv.tv_usec,
-                            max_devname_len, devname[idx], buf,
+                            max_devname_len, ifcache.entry[idx].name, buf,
                             extra_info);
                 }
 
@@ -1019,7 +987,7 @@ int main(int argc, char **argv)
                     sprint_canframe(buf, &frame, 0, maxdlen);
                     printf("(%010lu.%06lu) %*s %s%s\n",
                            tv.tv_sec, tv.tv_usec,
-                           max_devname_len, devname[idx], buf,
+                           max_devname_len, ifcache.entry[idx].name, buf,
                            extra_info);
                     goto out_fflush; /* no other output to stdout */
                 }
@@ -1079,7 +1047,7 @@ int main(int argc, char **argv)
                 }
 
                 printf(" %s", (color && (color < 3)) ? col_on[idx % MAXCOL] : "");
-                printf("%*s", max_devname_len, devname[idx]);
+                printf("%*s", max_devname_len, ifcache.entry[idx].name);
 
                 if (extra_msg_info)
                 {
@@ -1106,6 +1074,8 @@ int main(int argc, char **argv)
     for (i = 0; i < currmax; i++)
         close(s[i]);
 
+    ifcache_close(&ifcache);
+
     if (0 < uart_fd)
     {
         close(uart_fd);
@@ -79,12 +79,27 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <errno.h>
+#include <endian.h>
+
+#include <unistd.h>
 
 #include <sys/socket.h> /* for sa_family_t */
+#include <sys/ioctl.h>
+#include <net/if.h>
 #include <linux/can.h>
 #include <linux/can/error.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "lib.h"
 
@@ -96,23 +111,101 @@ const char hex_asc_upper[] = "0123456789ABCDEF";
 #define hex_asc_upper_lo(x)	hex_asc_upper[((x) & 0x0F)]
 #define hex_asc_upper_hi(x)	hex_asc_upper[((x) & 0xF0) >> 4]
 
+/* two ASCII hex digits for each byte value */
+static const char hex_byte_upper[] =
+	"000102030405060708090A0B0C0D0E0F"
+	"101112131415161718191A1B1C1D1E1F"
+	"202122232425262728292A2B2C2D2E2F"
+	"303132333435363738393A3B3C3D3E3F"
+	"404142434445464748494A4B4C4D4E4F"
+	"505152535455565758595A5B5C5D5E5F"
+	"606162636465666768696A6B6C6D6E6F"
+	"707172737475767778797A7B7C7D7E7F"
+	"808182838485868788898A8B8C8D8E8F"
+	"909192939495969798999A9B9C9D9E9F"
+	"A0A1A2A3A4A5A6A7A8A9AAABACADAEAF"
+	"B0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+	"C0C1C2C3C4C5C6C7C8C9CACBCCCDCECF"
+	"D0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+	"E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEF"
+	"F0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+
+/* binary representation of each nibble value */
+static const char bin_nibble[16][4] = {
+	"0000", "0001", "0010", "0011", "0100", "0101", "0110", "0111",
+	"1000", "1001", "1010", "1011", "1100", "1101", "1110", "1111"
+};
+
 static inline void put_hex_byte(char *buf, __u8 byte)
 {
-	buf[0] = hex_asc_upper_hi(byte);
-	buf[1] = hex_asc_upper_lo(byte);
+	memcpy(buf, &hex_byte_upper[byte << 1], 2);
 }
 
-static inline void _put_id(char *buf, int end_offset, canid_t id)
+/* convert 8 bytes into 16 ASCII hex digits */
+#if defined(__SSE2__)
+static inline void put_hex_8bytes(char *buf, const __u8 *data)
 {
-	/* build 3 (SFF) or 8 (EFF) digit CAN identifier */
-	while (end_offset >= 0) {
-		buf[end_offset--] = hex_asc_upper_lo(id);
-		id >>= 4;
-	}
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	__m128i v = _mm_loadl_epi64((const __m128i *)data);
+	__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+	__m128i lo = _mm_and_si128(v, nibble);
+	__m128i n = _mm_unpacklo_epi8(hi, lo); /* 16 nibbles in output order */
+	__m128i adj = _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)),
+				    _mm_set1_epi8('A' - '0' - 10));
+
+	n = _mm_add_epi8(n, _mm_add_epi8(adj, _mm_set1_epi8('0')));
+	_mm_storeu_si128((__m128i *)buf, n);
+}
+#elif defined(__ARM_NEON)
+static inline void put_hex_8bytes(char *buf, const __u8 *data)
+{
+	uint8x8_t v = vld1_u8(data);
+	uint8x8x2_t z = vzip_u8(vshr_n_u8(v, 4), vand_u8(v, vdup_n_u8(0x0F)));
+	uint8x16_t n = vcombine_u8(z.val[0], z.val[1]); /* 16 nibbles in output order */
+	uint8x16_t adj = vandq_u8(vcgtq_u8(n, vdupq_n_u8(9)),
+				  vdupq_n_u8('A' - '0' - 10));
+
+	n = vaddq_u8(n, vaddq_u8(adj, vdupq_n_u8('0')));
+	vst1q_u8((uint8_t *)buf, n);
+}
+#else
+static inline void put_hex_8bytes(char *buf, const __u8 *data)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		put_hex_byte(buf + 2 * i, data[i]);
+}
+#endif
+
+static inline int put_hex_data(char *buf, const __u8 *data, int len)
+{
+	int i;
+
+	/* only full 8 byte blocks to not touch the buffers beyond len */
+	for (i = 0; i + 8 <= len; i += 8)
+		put_hex_8bytes(buf + 2 * i, data + i);
+
+	for (; i < len; i++)
+		put_hex_byte(buf + 2 * i, data[i]);
+
+	return 2 * len;
 }
 
-#define put_sff_id(buf, id) _put_id(buf, 2, id)
-#define put_eff_id(buf, id) _put_id(buf, 7, id)
+/* build 3 (SFF) or 8 (EFF) digit CAN identifier */
+static inline void put_sff_id(char *buf, canid_t id)
+{
+	buf[0] = hex_asc_upper_lo(id >> 8);
+	put_hex_byte(buf + 1, id);
+}
+
+static inline void put_eff_id(char *buf, canid_t id)
+{
+	put_hex_byte(buf, id >> 24);
+	put_hex_byte(buf + 2, id >> 16);
+	put_hex_byte(buf + 4, id >> 8);
+	put_hex_byte(buf + 6, id);
+}
 
 /* CAN DLC to real data length conversion helpers */
 
@@ -145,19 +238,107 @@ unsigned char can_len2dlc(unsigned char len)
 	return len2dlc[len];
 }
 
+/* ASCII hex character to nibble value (16 = no hex character) */
+static const unsigned char hex_nibble[256] = {
+	16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,	/* 0x00 */
+	16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,	/* 0x10 */
+	16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,	/* 0x20 */
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 16, 16, 16, 16, 16, 16,	/* 0x30 */
+	16, 10, 11, 12, 13, 14, 15, 16, 16, 16, 16, 16, 16, 16, 16, 16,	/* 0x40 */
+	16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,	/* 0x50 */
+	16, 10, 11, 12, 13, 14, 15, 16, 16, 16, 16, 16, 16, 16, 16, 16,	/* 0x60 */
+	16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,	/* 0x70 */
+	16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,	/* 0x80 */
+	16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,	/* 0x90 */
+	16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,	/* 0xA0 */
+	16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,	/* 0xB0 */
+	16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,	/* 0xC0 */
+	16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,	/* 0xD0 */
+	16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,	/* 0xE0 */
+	16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16	/* 0xF0 */
+};
+
 unsigned char asc2nibble(char c) {
 
-	if ((c >= '0') && (c <= '9'))
-		return c - '0';
+	return hex_nibble[(unsigned char)c];
+}
+
+/*
+ * Convert 16 ASCII hex characters into 8 bytes.
+ * Returns 0 on success and 1 when at least one character is no hex character.
+ * Then nothing is written to data[] and the caller has to go byte by byte.
+ */
+#if defined(__SSE2__)
+static inline int hex16_to_8bytes(const char *src, unsigned char *data)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *)src);
+	__m128i lc = _mm_or_si128(v, _mm_set1_epi8(0x20)); /* 'A' -> 'a' */
+	__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+				      _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+	__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lc, _mm_set1_epi8('a' - 1)),
+				      _mm_cmplt_epi8(lc, _mm_set1_epi8('f' + 1)));
+	__m128i n, w;
+
+	if (_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xFFFF)
+		return 1;
+
+	n = _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(v, _mm_set1_epi8('0'))),
+			 _mm_and_si128(alpha, _mm_sub_epi8(lc, _mm_set1_epi8('a' - 10))));
 
-	if ((c >= 'A') && (c <= 'F'))
-		return c - 'A' + 10;
+	/* 16 bit lanes contain the high nibble in the low byte */
+	w = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(n, _mm_set1_epi16(0x0F)), 4),
+			 _mm_srli_epi16(n, 8));
+	_mm_storel_epi64((__m128i *)data, _mm_packus_epi16(w, w));
 
-	if ((c >= 'a') && (c <= 'f'))
-		return c - 'a' + 10;
+	return 0;
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+static inline int hex16_to_8bytes(const char *src, unsigned char *data)
+{
+	uint8x16_t v = vld1q_u8((const uint8_t *)src);
+	uint8x16_t lc = vorrq_u8(v, vdupq_n_u8(0x20)); /* 'A' -> 'a' */
+	uint8x16_t digit = vandq_u8(vcgeq_u8(v, vdupq_n_u8('0')),
+				    vcleq_u8(v, vdupq_n_u8('9')));
+	uint8x16_t alpha = vandq_u8(vcgeq_u8(lc, vdupq_n_u8('a')),
+				    vcleq_u8(lc, vdupq_n_u8('f')));
+	uint8x16_t n;
+	uint16x8_t w;
+
+	if (vminvq_u8(vorrq_u8(digit, alpha)) != 0xFF)
+		return 1;
+
+	n = vorrq_u8(vandq_u8(digit, vsubq_u8(v, vdupq_n_u8('0'))),
+		     vandq_u8(alpha, vsubq_u8(lc, vdupq_n_u8('a' - 10))));
 
-	return 16; /* error */
+	/* 16 bit lanes contain the high nibble in the low byte */
+	w = vreinterpretq_u16_u8(n);
+	w = vorrq_u16(vshlq_n_u16(vandq_u16(w, vdupq_n_u16(0x0F)), 4), vshrq_n_u16(w, 8));
+	vst1_u8(data, vmovn_u16(w));
+
+	return 0;
+}
+#else
+static inline int hex16_to_8bytes(const char *src, unsigned char *data)
+{
+	unsigned char tmp[8];
+	unsigned char err = 0;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		unsigned char hi = hex_nibble[(unsigned char)src[2 * i]];
+		unsigned char lo = hex_nibble[(unsigned char)src[2 * i + 1]];
+
+		err |= hi | lo;
+		tmp[i] = (hi << 4) | lo;
+	}
+
+	if (err & 0x10)
+		return 1;
+
+	memcpy(data, tmp, 8);
+	return 0;
 }
+#endif
 
 int hexstring2data(char *arg, unsigned char *data, int maxdlen) {
 
@@ -170,7 +351,12 @@ int hexstring2data(char *arg, unsigned char *data, int maxdlen) {
 
 	memset(data, 0, maxdlen);
 
-	for (i=0; i < len/2; i++) {
+	for (i=0; i + 8 <= len/2; i += 8) {
+		if (hex16_to_8bytes(arg + 2*i, data + i))
+			break; /* find the wrong character below */
+	}
+
+	for (; i < len/2; i++) {
 
 		tmp = asc2nibble(*(arg+(2*i)));
 		if (tmp > 0x0F)
@@ -188,17 +374,13 @@ int hexstring2data(char *arg, unsigned char *data, int maxdlen) {
 	return 0;
 }
 
-int parse_canframe(char *cs, struct canfd_frame *cf) {
-	/* documentation see lib.h */
+static int parse_canframe_len(char *cs, int len, struct canfd_frame *cf) {
 
-	int i, idx, dlen, len;
+	int i, idx, dlen, bulk = 1;
 	int maxdlen = CAN_MAX_DLEN;
 	int ret = CAN_MTU;
 	unsigned char tmp;
 
-	len = strlen(cs);
-	//printf("'%s' len %d\n", cs, len);
-
 	memset(cf, 0, sizeof(*cf)); /* init CAN FD frame, e.g. LEN = 0 */
 
 	if (len < 4)
@@ -208,18 +390,32 @@ int parse_canframe(char *cs, struct canfd_frame *cf) {
 
 		idx = 4;
 		for (i=0; i<3; i++){
-			if ((tmp = asc2nibble(cs[i])) > 0x0F)
+			if ((tmp = hex_nibble[(unsigned char)cs[i]]) > 0x0F)
 				return 0;
 			cf->can_id |= (tmp << (2-i)*4);
 		}
 
-	} else if (cs[8] == CANID_DELIM) { /* 8 digits */
+	} else if (len > 8 && cs[8] == CANID_DELIM) { /* 8 digits */
+
+		canid_t id = 0;
+		unsigned char err = 0;
 
 		idx = 9;
 		for (i=0; i<8; i++){
-			if ((tmp = asc2nibble(cs[i])) > 0x0F)
-				return 0;
-			cf->can_id |= (tmp << (7-i)*4);
+			tmp = hex_nibble[(unsigned char)cs[i]];
+			err |= tmp;
+			id = (id << 4) | (tmp & 0x0F);
+		}
+		cf->can_id = id;
+
+		if (err > 0x0F) {
+			/* provide the partly converted CAN ID as before */
+			cf->can_id = 0;
+			for (i=0; i<8; i++){
+				if ((tmp = hex_nibble[(unsigned char)cs[i]]) > 0x0F)
+					return 0;
+				cf->can_id |= (tmp << (7-i)*4);
+			}
 		}
 		if (!(cf->can_id & CAN_ERR_FLAG)) /* 8 digits but no errorframe?  */
 			cf->can_id |= CAN_EFF_FLAG;   /* then it is an extended frame */
@@ -231,7 +427,7 @@ int parse_canframe(char *cs, struct canfd_frame *cf) {
 		cf->can_id |= CAN_RTR_FLAG;
 
 		/* check for optional DLC value for CAN 2.0B frames */
-		if(cs[++idx] && (tmp = asc2nibble(cs[idx])) <= CAN_MAX_DLC)
+		if(idx + 1 < len && (tmp = hex_nibble[(unsigned char)cs[++idx]]) <= CAN_MAX_DLC)
 			cf->len = tmp;
 
 		return ret;
@@ -243,7 +439,7 @@ int parse_canframe(char *cs, struct canfd_frame *cf) {
 		ret = CANFD_MTU;
 
 		/* CAN FD frame <canid>##<flags><data>* */
-		if ((tmp = asc2nibble(cs[idx+1])) > 0x0F)
+		if (idx + 1 >= len || (tmp = hex_nibble[(unsigned char)cs[idx+1]]) > 0x0F)
 			return 0;
 
 		cf->flags = tmp;
@@ -252,16 +448,30 @@ int parse_canframe(char *cs, struct canfd_frame *cf) {
 
 	for (i=0, dlen=0; i < maxdlen; i++){
 
-		if(cs[idx] == DATA_SEPERATOR) /* skip (optional) separator */
+		/* convert 8 bytes at once until the first separator shows up */
+		while (bulk && i + 8 <= maxdlen && idx + 16 <= len) {
+			if (hex16_to_8bytes(cs + idx, cf->data + i)) {
+				bulk = 0;
+				break;
+			}
+			i += 8;
+			dlen += 8;
+			idx += 16;
+		}
+
+		if (i >= maxdlen)
+			break;
+
+		if(idx < len && cs[idx] == DATA_SEPERATOR) /* skip (optional) separator */
 			idx++;
 
 		if(idx >= len) /* end of string => end of data */
 			break;
 
-		if ((tmp = asc2nibble(cs[idx++])) > 0x0F)
+		if ((tmp = hex_nibble[(unsigned char)cs[idx++]]) > 0x0F)
 			return 0;
 		cf->data[i] = (tmp << 4);
-		if ((tmp = asc2nibble(cs[idx++])) > 0x0F)
+		if (idx >= len || (tmp = hex_nibble[(unsigned char)cs[idx++]]) > 0x0F)
 			return 0;
 		cf->data[i] |= tmp;
 		dlen++;
@@ -271,18 +481,39 @@ int parse_canframe(char *cs, struct canfd_frame *cf) {
 	return ret;
 }
 
+int parse_canframe(char *cs, struct canfd_frame *cf) {
+	/* documentation see lib.h */
+
+	return parse_canframe_len(cs, strlen(cs), cf);
+}
+
+int parse_canframe_token(char *cs, struct canfd_frame *cf, int *consumed) {
+	/* documentation see lib.h */
+
+	int len = 0;
+
+	/* the frame ends at the end of the string or at the next whitespace */
+	while (cs[len] && cs[len] != ' ' && cs[len] != '\t' &&
+	       cs[len] != '\n' && cs[len] != '\r')
+		len++;
+
+	if (consumed)
+		*consumed = len;
+
+	return parse_canframe_len(cs, len, cf);
+}
+
 void fprint_canframe(FILE *stream , struct canfd_frame *cf, char *eol, int sep, int maxdlen) {
 	/* documentation see lib.h */
 
 	char buf[CL_CFSZ]; /* max length */
 
-	sprint_canframe(buf, cf, sep, maxdlen);
-	fprintf(stream, "%s", buf);
+	fwrite(buf, 1, sprint_canframe(buf, cf, sep, maxdlen), stream);
 	if (eol)
 		fprintf(stream, "%s", eol);
 }
 
-void sprint_canframe(char *buf , struct canfd_frame *cf, int sep, int maxdlen) {
+int sprint_canframe(char *buf , struct canfd_frame *cf, int sep, int maxdlen) {
 	/* documentation see lib.h */
 
 	int i,offset;
@@ -310,7 +541,7 @@ void sprint_canframe(char *buf , struct canfd_frame *cf, int sep, int maxdlen) {
 			buf[offset++] = hex_asc_upper_lo(cf->len);
 
 		buf[offset] = 0;
-		return;
+		return offset;
 	}
 
 	if (maxdlen == CANFD_MAX_DLEN) {
@@ -321,14 +552,20 @@ void sprint_canframe(char *buf , struct canfd_frame *cf, int sep, int maxdlen) {
 			buf[offset++] = '.';
 	}
 
-	for (i = 0; i < len; i++) {
-		put_hex_byte(buf + offset, cf->data[i]);
-		offset += 2;
-		if (sep && (i+1 < len))
-			buf[offset++] = '.';
+	if (!sep)
+		offset += put_hex_data(buf + offset, cf->data, len);
+	else {
+		for (i = 0; i < len; i++) {
+			put_hex_byte(buf + offset, cf->data[i]);
+			offset += 2;
+			if (i+1 < len)
+				buf[offset++] = '.';
+		}
 	}
 
 	buf[offset] = 0;
+
+	return offset;
 }
 
 void fprint_long_canframe(FILE *stream , struct canfd_frame *cf, char *eol, int view, int maxdlen) {
@@ -336,8 +573,7 @@ void fprint_long_canframe(FILE *stream , struct canfd_frame *cf, char *eol, int
 
 	char buf[CL_LONGCFSZ];
 
-	sprint_long_canframe(buf, cf, view, maxdlen);
-	fprintf(stream, "%s", buf);
+	fwrite(buf, 1, sprint_long_canframe(buf, cf, view, maxdlen), stream);
 	if ((view & CANLIB_VIEW_ERROR) && (cf->can_id & CAN_ERR_FLAG)) {
 		snprintf_can_error_frame(buf, sizeof(buf), cf, "\n\t");
 		fprintf(stream, "\n\t%s", buf);
@@ -346,7 +582,7 @@ void fprint_long_canframe(FILE *stream , struct canfd_frame *cf, char *eol, int
 		fprintf(stream, "%s", eol);
 }
 
-void sprint_long_canframe(char *buf , struct canfd_frame *cf, int view, int maxdlen) {
+int sprint_long_canframe(char *buf , struct canfd_frame *cf, int view, int maxdlen) {
 	/* documentation see lib.h */
 
 	int i, j, dlen, offset;
@@ -379,8 +615,8 @@ void sprint_long_canframe(char *buf , struct canfd_frame *cf, int view, int maxd
 
 		/* standard CAN frames may have RTR enabled */
 		if (cf->can_id & CAN_RTR_FLAG) {
-			sprintf(buf+offset+5, " remote request");
-			return;
+			memcpy(buf+offset+5, " remote request", sizeof(" remote request"));
+			return offset + 5 + sizeof(" remote request") - 1;
 		}
 	} else {
 		buf[offset] = '[';
@@ -394,15 +630,17 @@ void sprint_long_canframe(char *buf , struct canfd_frame *cf, int view, int maxd
 		dlen = 9; /* _10101010 */
 		if (view & CANLIB_VIEW_SWAP) {
 			for (i = len - 1; i >= 0; i--) {
-				buf[offset++] = (i == len-1)?' ':SWAP_DELIMITER;
-				for (j = 7; j >= 0; j--)
-					buf[offset++] = (1<<j & cf->data[i])?'1':'0';
+				buf[offset] = (i == len-1)?' ':SWAP_DELIMITER;
+				memcpy(buf + offset + 1, bin_nibble[cf->data[i] >> 4], 4);
+				memcpy(buf + offset + 5, bin_nibble[cf->data[i] & 0x0F], 4);
+				offset += 9;
 			}
 		} else {
 			for (i = 0; i < len; i++) {
-				buf[offset++] = ' ';
-				for (j = 7; j >= 0; j--)
-					buf[offset++] = (1<<j & cf->data[i])?'1':'0';
+				buf[offset] = ' ';
+				memcpy(buf + offset + 1, bin_nibble[cf->data[i] >> 4], 4);
+				memcpy(buf + offset + 5, bin_nibble[cf->data[i] & 0x0F], 4);
+				offset += 9;
 			}
 		}
 	} else {
@@ -434,34 +672,42 @@ void sprint_long_canframe(char *buf , struct canfd_frame *cf, int view, int maxd
 	 * Does it make sense to write 64 ASCII byte behind 64 ASCII HEX data on the console?
 	 */
 	if (len > CAN_MAX_DLEN)
-		return;
+		return offset;
+
+	if (cf->can_id & CAN_ERR_FLAG) {
+		/* right aligned like printf("%*s", dlen*(8-len)+13, "ERRORFRAME") */
+		j = dlen*(8-len)+13 - (sizeof("ERRORFRAME") - 1);
+		memset(buf + offset, ' ', j);
+		offset += j;
+		memcpy(buf + offset, "ERRORFRAME", sizeof("ERRORFRAME"));
+		offset += sizeof("ERRORFRAME") - 1;
+	} else if (view & CANLIB_VIEW_ASCII) {
+		char quote = (view & CANLIB_VIEW_SWAP)?'`':'\'';
 
-	if (cf->can_id & CAN_ERR_FLAG)
-		sprintf(buf+offset, "%*s", dlen*(8-len)+13, "ERRORFRAME");
-	else if (view & CANLIB_VIEW_ASCII) {
 		j = dlen*(8-len)+4;
+		memset(buf + offset, ' ', j - 1);
+		offset += j;
+		buf[offset - 1] = quote;
+
 		if (view & CANLIB_VIEW_SWAP) {
-			sprintf(buf+offset, "%*s", j, "`");
-			offset += j;
 			for (i = len - 1; i >= 0; i--)
 				if ((cf->data[i] > 0x1F) && (cf->data[i] < 0x7F))
 					buf[offset++] = cf->data[i];
 				else
 					buf[offset++] = '.';
-
-			sprintf(buf+offset, "`");
 		} else {
-			sprintf(buf+offset, "%*s", j, "'");
-			offset += j;
 			for (i = 0; i < len; i++)
 				if ((cf->data[i] > 0x1F) && (cf->data[i] < 0x7F))
 					buf[offset++] = cf->data[i];
 				else
 					buf[offset++] = '.';
-
-			sprintf(buf+offset, "'");
 		}
+
+		buf[offset++] = quote;
+		buf[offset] = 0;
 	}
+
+	return offset;
 }
 
 static const char *error_classes[] = {
@@ -642,3 +888,455 @@ void snprintf_can_error_frame(char *buf, size_t len, const struct canfd_frame *c
 			      cf->data[6], cf->data[7]);
 	}
 }
+
+/* compact binary log file format - documentation see lib.h */
+
+#define BINLOG_FRAMESZ 16	/* FRAME record data without payload */
+#define BINLOG_DROPSZ 18	/* DROP record data */
+
+static inline void put_le16(unsigned char *p, uint16_t val)
+{
+	val = htole16(val);
+	memcpy(p, &val, sizeof(val));
+}
+
+static inline void put_le32(unsigned char *p, uint32_t val)
+{
+	val = htole32(val);
+	memcpy(p, &val, sizeof(val));
+}
+
+static inline void put_le64(unsigned char *p, uint64_t val)
+{
+	val = htole64(val);
+	memcpy(p, &val, sizeof(val));
+}
+
+static inline uint16_t get_le16(const unsigned char *p)
+{
+	uint16_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return le16toh(val);
+}
+
+static inline uint32_t get_le32(const unsigned char *p)
+{
+	uint32_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return le32toh(val);
+}
+
+static inline uint64_t get_le64(const unsigned char *p)
+{
+	uint64_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return le64toh(val);
+}
+
+static inline void put_rechdr(unsigned char *p, int type, int flags, int datalen)
+{
+	p[0] = type;
+	p[1] = flags;
+	put_le16(p + 2, datalen);
+}
+
+static int binlog_resize(struct binlog *bl, int ifid)
+{
+	char (*ifname)[BINLOG_IFNAMSZ];
+	int ifnum = bl->ifnum ? bl->ifnum : 16;
+
+	while (ifnum <= ifid)
+		ifnum *= 2;
+
+	ifname = realloc(bl->ifname, ifnum * sizeof(*ifname));
+	if (!ifname)
+		return 1;
+
+	memset(&ifname[bl->ifnum], 0, (ifnum - bl->ifnum) * sizeof(*ifname));
+	bl->ifname = ifname;
+	bl->ifnum = ifnum;
+
+	return 0;
+}
+
+static int binlog_put_ifname(struct binlog *bl, int ifid, const char *ifname)
+{
+	unsigned char rec[BINLOG_RECHDRSZ + 2 + BINLOG_IFNAMSZ];
+	int namelen;
+
+	if (ifid < 0 || ifid > 0xFFFF) {
+		errno = EINVAL;
+		return 1;
+	}
+
+	if (ifid < bl->ifnum && !strncmp(bl->ifname[ifid], ifname, BINLOG_IFNAMSZ))
+		return 0; /* already known */
+
+	if (ifid >= bl->ifnum && binlog_resize(bl, ifid))
+		return 1;
+
+	namelen = strnlen(ifname, BINLOG_IFNAMSZ - 1);
+	memcpy(bl->ifname[ifid], ifname, namelen);
+	bl->ifname[ifid][namelen] = 0;
+
+	put_rechdr(rec, BINLOG_REC_IFNAME, 0, 2 + namelen);
+	put_le16(rec + BINLOG_RECHDRSZ, ifid);
+	memcpy(rec + BINLOG_RECHDRSZ + 2, ifname, namelen);
+
+	if (fwrite(rec, BINLOG_RECHDRSZ + 2 + namelen, 1, bl->stream) != 1)
+		return 1;
+
+	bl->size += BINLOG_RECHDRSZ + 2 + namelen;
+
+	return 0;
+}
+
+static inline uint64_t binlog_ts2ns(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+int binlog_open_write(struct binlog *bl, FILE *stream)
+{
+	unsigned char hdr[BINLOG_HDRSZ];
+
+	memset(bl, 0, sizeof(*bl));
+	bl->stream = stream;
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, BINLOG_MAGIC, sizeof(BINLOG_MAGIC));
+	put_le16(hdr + 8, BINLOG_VERSION);
+	put_le16(hdr + 10, BINLOG_HDRSZ);
+
+	if (fwrite(hdr, sizeof(hdr), 1, stream) != 1)
+		return 1;
+
+	bl->size = sizeof(hdr);
+
+	return 0;
+}
+
+int binlog_write_frame(struct binlog *bl, const struct timespec *ts, int ifid,
+		       const char *ifname, struct canfd_frame *cf, int mtu, int flags)
+{
+	unsigned char rec[BINLOG_RECHDRSZ + BINLOG_FRAMESZ + CANFD_MAX_DLEN];
+	unsigned char *data = rec + BINLOG_RECHDRSZ;
+	int maxdlen = CAN_MAX_DLEN;
+	int len;
+
+	if (binlog_put_ifname(bl, ifid, ifname))
+		return 1;
+
+	flags &= ~BINLOG_FLAG_CANFD;
+	if (mtu == CANFD_MTU) {
+		flags |= BINLOG_FLAG_CANFD;
+		maxdlen = CANFD_MAX_DLEN;
+	}
+
+	/* a CAN 2.0 RTR frame carries its DLC in len but no data */
+	len = (cf->len > maxdlen) ? maxdlen : cf->len;
+	if (cf->can_id & CAN_RTR_FLAG)
+		len = 0;
+
+	put_rechdr(rec, BINLOG_REC_FRAME, flags, BINLOG_FRAMESZ + len);
+	put_le64(data, binlog_ts2ns(ts));
+	put_le16(data + 8, ifid);
+	put_le32(data + 10, cf->can_id);
+	data[14] = cf->len;
+	data[15] = cf->flags;
+	memcpy(data + BINLOG_FRAMESZ, cf->data, len);
+
+	if (fwrite(rec, BINLOG_RECHDRSZ + BINLOG_FRAMESZ + len, 1, bl->stream) != 1)
+		return 1;
+
+	bl->size += BINLOG_RECHDRSZ + BINLOG_FRAMESZ + len;
+
+	return 0;
+}
+
+int binlog_write_drop(struct binlog *bl, const struct timespec *ts, int ifid,
+		      const char *ifname, unsigned int drops, unsigned int total_drops)
+{
+	unsigned char rec[BINLOG_RECHDRSZ + BINLOG_DROPSZ];
+	unsigned char *data = rec + BINLOG_RECHDRSZ;
+
+	if (binlog_put_ifname(bl, ifid, ifname))
+		return 1;
+
+	put_rechdr(rec, BINLOG_REC_DROP, 0, BINLOG_DROPSZ);
+	put_le64(data, binlog_ts2ns(ts));
+	put_le16(data + 8, ifid);
+	put_le32(data + 10, drops);
+	put_le32(data + 14, total_drops);
+
+	if (fwrite(rec, sizeof(rec), 1, bl->stream) != 1)
+		return 1;
+
+	bl->size += sizeof(rec);
+
+	return 0;
+}
+
+int binlog_open_read(struct binlog *bl, FILE *stream)
+{
+	unsigned char hdr[BINLOG_HDRSZ];
+	int hdrlen;
+
+	memset(bl, 0, sizeof(*bl));
+	bl->stream = stream;
+
+	if (fread(hdr, sizeof(hdr), 1, stream) != 1)
+		return 1;
+
+	if (memcmp(hdr, BINLOG_MAGIC, sizeof(BINLOG_MAGIC)))
+		return 1;
+
+	if (get_le16(hdr + 8) > BINLOG_VERSION)
+		return 1;
+
+	/* skip header extensions of compatible format versions */
+	hdrlen = get_le16(hdr + 10);
+	if (hdrlen < BINLOG_HDRSZ)
+		return 1;
+
+	for (hdrlen -= BINLOG_HDRSZ; hdrlen; hdrlen--)
+		if (fgetc(stream) == EOF)
+			return 1;
+
+	return 0;
+}
+
+int binlog_read(struct binlog *bl, struct binlog_entry *e)
+{
+	unsigned char rec[BINLOG_RECHDRSZ];
+	unsigned char data[0xFFFF];
+	uint64_t ns;
+	int datalen, ifid, len;
+
+	while (1) {
+		if (fread(rec, sizeof(rec), 1, bl->stream) != 1)
+			return feof(bl->stream) ? 0 : -1;
+
+		datalen = get_le16(rec + 2);
+		if (datalen && fread(data, datalen, 1, bl->stream) != 1)
+			return -1; /* truncated record */
+
+		switch (rec[0]) {
+
+		case BINLOG_REC_IFNAME:
+			if (datalen < 2)
+				return -1;
+			ifid = get_le16(data);
+			if (ifid >= bl->ifnum && binlog_resize(bl, ifid))
+				return -1;
+			len = datalen - 2;
+			if (len >= BINLOG_IFNAMSZ)
+				len = BINLOG_IFNAMSZ - 1;
+			memcpy(bl->ifname[ifid], data + 2, len);
+			bl->ifname[ifid][len] = 0;
+			continue;
+
+		case BINLOG_REC_FRAME:
+			if (datalen < BINLOG_FRAMESZ)
+				return -1;
+			memset(&e->frame, 0, sizeof(e->frame));
+			e->frame.can_id = get_le32(data + 10);
+			e->frame.len = data[14];
+			e->frame.flags = data[15];
+			len = datalen - BINLOG_FRAMESZ;
+			if (len > CANFD_MAX_DLEN)
+				return -1;
+			memcpy(e->frame.data, data + BINLOG_FRAMESZ, len);
+			e->mtu = (rec[1] & BINLOG_FLAG_CANFD) ? CANFD_MTU : CAN_MTU;
+			e->drops = e->total_drops = 0;
+			break;
+
+		case BINLOG_REC_DROP:
+			if (datalen < BINLOG_DROPSZ)
+				return -1;
+			e->drops = get_le32(data + 10);
+			e->total_drops = get_le32(data + 14);
+			e->mtu = 0;
+			break;
+
+		default:
+			continue; /* skip unknown record types */
+		}
+
+		ifid = get_le16(data + 8);
+		if (ifid >= bl->ifnum || !bl->ifname[ifid][0])
+			return -1; /* undefined interface name */
+
+		ns = get_le64(data);
+		e->type = rec[0];
+		e->flags = rec[1];
+		e->ts.tv_sec = ns / 1000000000ULL;
+		e->ts.tv_nsec = ns % 1000000000ULL;
+		e->ifname = bl->ifname[ifid];
+
+		return 1;
+	}
+}
+
+void binlog_close(struct binlog *bl)
+{
+	free(bl->ifname);
+	bl->ifname = NULL;
+	bl->ifnum = 0;
+}
+
+static void ifcache_set(struct ifcache *c, unsigned int i, int ifindex,
+			const char *name)
+{
+	int len = strnlen(name, IFNAMSIZ - 1);
+
+	c->entry[i].ifindex = ifindex;
+	memcpy(c->entry[i].name, name, len);
+	c->entry[i].name[len] = 0;
+
+	if (c->max_len < len)
+		c->max_len = len;
+}
+
+static int ifcache_grow(struct ifcache *c, int ifindex)
+{
+	struct ifcache_entry *entry;
+	unsigned int size = c->mask + 1;
+	unsigned int i, mask;
+
+	/* find a size where both entries can live side by side */
+	do {
+		size *= 2;
+		mask = size - 1;
+	} while (size < IFCACHE_MAXSZ &&
+		 (c->entry[ifindex & c->mask].ifindex & mask) == (ifindex & mask));
+
+	entry = calloc(size, sizeof(*entry));
+	if (!entry)
+		return 1;
+
+	/* rehash - colliding entries are dropped and fetched again on demand */
+	for (i = 0; i <= c->mask; i++) {
+		if (c->entry[i].ifindex)
+			entry[c->entry[i].ifindex & mask] = c->entry[i];
+	}
+
+	free(c->entry);
+	c->entry = entry;
+	c->mask = mask;
+
+	return 0;
+}
+
+int ifcache_open(struct ifcache *c, int sock)
+{
+	struct sockaddr_nl snl;
+
+	memset(c, 0, sizeof(*c));
+	c->sock = sock;
+	c->mask = IFCACHE_MINSZ - 1;
+	c->entry = calloc(IFCACHE_MINSZ, sizeof(*c->entry));
+	if (!c->entry)
+		return 1;
+
+	/* without RTNETLINK the cache is not invalidated - not fatal */
+	c->nl = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (c->nl < 0)
+		return 0;
+
+	memset(&snl, 0, sizeof(snl));
+	snl.nl_family = AF_NETLINK;
+	snl.nl_groups = RTMGRP_LINK;
+
+	if (bind(c->nl, (struct sockaddr *)&snl, sizeof(snl)) < 0) {
+		close(c->nl);
+		c->nl = -1;
+	}
+
+	return 0;
+}
+
+int ifcache_index(struct ifcache *c, int ifindex)
+{
+	unsigned int i = ifindex & c->mask;
+	struct ifreq ifr;
+
+	if (c->entry[i].ifindex == ifindex)
+		return i;
+
+	/* cache miss - make room when the entry is used by another interface */
+	if (c->entry[i].ifindex && c->mask + 1 < IFCACHE_MAXSZ && !ifcache_grow(c, ifindex))
+		i = ifindex & c->mask;
+
+	ifr.ifr_ifindex = ifindex;
+	if (ioctl(c->sock, SIOCGIFNAME, &ifr) < 0)
+		snprintf(ifr.ifr_name, IFNAMSIZ, "if%d", ifindex); /* vanished */
+
+	ifcache_set(c, i, ifindex, ifr.ifr_name);
+
+	return i;
+}
+
+void ifcache_update(struct ifcache *c)
+{
+	char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *nlh;
+	struct ifinfomsg *ifi;
+	struct rtattr *rta;
+	unsigned int i;
+	int len, alen;
+
+	if (c->nl < 0)
+		return;
+
+	while (1) {
+		len = recv(c->nl, buf, sizeof(buf), MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == ENOBUFS) {
+				/* lost notifications - start from scratch */
+				memset(c->entry, 0, (c->mask + 1) * sizeof(*c->entry));
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			return; /* EAGAIN: all notifications processed */
+		}
+
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, (unsigned int)len);
+		     nlh = NLMSG_NEXT(nlh, len)) {
+
+			if (nlh->nlmsg_type != RTM_NEWLINK && nlh->nlmsg_type != RTM_DELLINK)
+				continue;
+
+			ifi = NLMSG_DATA(nlh);
+			i = ifi->ifi_index & c->mask;
+			if (c->entry[i].ifindex != ifi->ifi_index)
+				continue; /* not cached */
+
+			if (nlh->nlmsg_type == RTM_DELLINK) {
+				c->entry[i].ifindex = 0;
+				continue;
+			}
+
+			/* RTM_NEWLINK is also sent for a renamed interface */
+			alen = IFLA_PAYLOAD(nlh);
+			for (rta = IFLA_RTA(ifi); RTA_OK(rta, alen); rta = RTA_NEXT(rta, alen)) {
+				if (rta->rta_type == IFLA_IFNAME)
+					ifcache_set(c, i, ifi->ifi_index, RTA_DATA(rta));
+			}
+		}
+	}
+}
+
+void ifcache_close(struct ifcache *c)
+{
+	if (c->nl >= 0)
+		close(c->nl);
+	c->nl = -1;
+
+	free(c->entry);
+	c->entry = NULL;
+}
@@ -118,6 +118,8 @@
 #define CAN_UTILS_LIB_H
 
 #include <stdio.h>
+#include <time.h>
+#include <net/if.h>
 
 /* buffer sizes for CAN frame string representations */
 
@@ -220,11 +222,22 @@ int parse_canframe(char *cs, struct canfd_frame *cf);
  * - CAN FD frames do not have a RTR bit
  */
 
+int parse_canframe_token(char *cs, struct canfd_frame *cf, int *consumed);
+/*
+ * Like parse_canframe() but the CAN frame ends at the end of the string or
+ * at the next whitespace (' ', '\t', '\r', '\n'). The length of the CAN
+ * frame string is returned in 'consumed' (if not NULL), so that a log file
+ * line can be processed without splitting it up with sscanf() before.
+ *
+ * Return values: see parse_canframe()
+ */
+
 void fprint_canframe(FILE *stream , struct canfd_frame *cf, char *eol, int sep, int maxdlen);
-void sprint_canframe(char *buf , struct canfd_frame *cf, int sep, int maxdlen);
+int sprint_canframe(char *buf , struct canfd_frame *cf, int sep, int maxdlen);
 /*
  * Creates a CAN frame hexadecimal output in compact format.
  * The CAN data[] is separated by '.' when sep != 0.
+ * Returns the length of the created string (without termination).
  *
  * The type of the CAN frame (CAN 2.0 / CAN FD) is specified by maxdlen:
  * maxdlen = 8 -> CAN2.0 frame
@@ -255,9 +268,10 @@ void sprint_canframe(char *buf , struct canfd_frame *cf, int sep, int maxdlen);
 #define SWAP_DELIMITER '`'
 
 void fprint_long_canframe(FILE *stream , struct canfd_frame *cf, char *eol, int view, int maxdlen);
-void sprint_long_canframe(char *buf , struct canfd_frame *cf, int view, int maxdlen);
+int sprint_long_canframe(char *buf , struct canfd_frame *cf, int view, int maxdlen);
 /*
  * Creates a CAN frame hexadecimal output in user readable format.
+ * Returns the length of the created string (without termination).
  *
  * The type of the CAN frame (CAN 2.0 / CAN FD) is specified by maxdlen:
  * maxdlen = 8 -> CAN2.0 frame
@@ -288,4 +302,141 @@ void snprintf_can_error_frame(char *buf, size_t len, const struct canfd_frame *c
  * Creates a CAN error frame output in user readable format.
  */
 
+/* compact binary log file format */
+
+#define BINLOG_MAGIC "CANBLOG"	/* 8 bytes including the termination */
+#define BINLOG_VERSION 1
+#define BINLOG_HDRSZ 16		/* size of the file header */
+#define BINLOG_RECHDRSZ 4	/* size of the record header */
+#define BINLOG_IFNAMSZ 16	/* max. interface name length incl. termination */
+
+/* record types */
+#define BINLOG_REC_IFNAME 1	/* (re)define an interface name table entry */
+#define BINLOG_REC_FRAME 2	/* received CAN frame */
+#define BINLOG_REC_DROP 3	/* notification about dropped CAN frames */
+
+/* record flags */
+#define BINLOG_FLAG_CANFD 0x1	/* CAN FD frame (CANFD_MTU) */
+#define BINLOG_FLAG_TX 0x2	/* frame has been sent by the local host */
+
+struct binlog {
+	FILE *stream;
+	int ifnum;			/* entries in the interface name table */
+	char (*ifname)[BINLOG_IFNAMSZ];	/* interface name table */
+	unsigned long long size;	/* bytes written to the stream */
+};
+
+struct binlog_entry {
+	int type;			/* BINLOG_REC_FRAME or BINLOG_REC_DROP */
+	int flags;			/* BINLOG_FLAG_* */
+	int mtu;			/* CAN_MTU or CANFD_MTU */
+	struct timespec ts;		/* timestamp with nanosecond resolution */
+	const char *ifname;		/* valid until binlog_close() */
+	struct canfd_frame frame;	/* content of BINLOG_REC_FRAME */
+	unsigned int drops;		/* content of BINLOG_REC_DROP */
+	unsigned int total_drops;
+};
+
+int binlog_open_write(struct binlog *bl, FILE *stream);
+int binlog_write_frame(struct binlog *bl, const struct timespec *ts, int ifid,
+		       const char *ifname, struct canfd_frame *cf, int mtu, int flags);
+int binlog_write_drop(struct binlog *bl, const struct timespec *ts, int ifid,
+		      const char *ifname, unsigned int drops, unsigned int total_drops);
+/*
+ * Writes a compact binary log file.
+ *
+ * binlog_open_write() writes the file header to the given stream.
+ *
+ * The caller identifies each interface with a small integer 'ifid'
+ * (0 .. 65535). An interface name table entry is written into the log
+ * whenever the name for a given 'ifid' is used for the first time or
+ * has changed since the last record with this 'ifid'. The number of
+ * bytes written so far is available in 'size' (e.g. for log rotation).
+ *
+ * All values are stored in little endian byte order. Each record starts
+ * with a header containing the record type, the record flags and the
+ * length of the following record data, so that readers can skip unknown
+ * record types:
+ *
+ * file header   : "CANBLOG\0" version:16 hdrlen:16 reserved:32
+ * record header : type:8 flags:8 datalen:16
+ * IFNAME data   : ifid:16 name[datalen - 2] (no termination)
+ * FRAME data    : tstamp_ns:64 ifid:16 can_id:32 len:8 flags:8 data[len]
+ * DROP data     : tstamp_ns:64 ifid:16 drops:32 total_drops:32
+ *
+ * Return values:
+ * 0 = success
+ * 1 = error (see errno)
+ */
+
+int binlog_open_read(struct binlog *bl, FILE *stream);
+int binlog_read(struct binlog *bl, struct binlog_entry *e);
+/*
+ * Reads a compact binary log file.
+ *
+ * binlog_open_read() checks the file header and returns 0 on success and
+ * 1 when the stream does not contain a supported binary log file.
+ *
+ * binlog_read() processes the interface name table entries internally and
+ * returns the next CAN frame or drop notification in 'e'.
+ *
+ * Return values of binlog_read():
+ *  1 = valid entry
+ *  0 = end of file
+ * -1 = error (broken or truncated log file)
+ */
+
+void binlog_close(struct binlog *bl);
+/*
+ * Releases the interface name table. The stream is not closed.
+ */
+
+#define IFCACHE_MINSZ 64	/* initial number of cache entries */
+#define IFCACHE_MAXSZ 65536	/* max number of cache entries */
+
+struct ifcache_entry {
+	int ifindex;			/* 0 = unused entry */
+	char name[IFNAMSIZ];
+};
+
+struct ifcache {
+	struct ifcache_entry *entry;	/* direct mapped by ifindex */
+	unsigned int mask;		/* number of entries - 1 */
+	int nl;				/* RTNETLINK socket or -1 */
+	int sock;			/* socket for SIOCGIFNAME on a cache miss */
+	int max_len;			/* length of the longest name in the cache */
+};
+
+int ifcache_open(struct ifcache *c, int sock);
+/*
+ * Creates a cache for the interface index to interface name conversion.
+ *
+ * The entries are direct mapped by the interface index. A cache miss is
+ * resolved with a SIOCGIFNAME ioctl on the given socket. The cache is kept
+ * up to date by RTNETLINK link notifications: the caller has to watch the
+ * file descriptor 'nl' (if not -1) for reading and call ifcache_update().
+ *
+ * Returns 0 on success and 1 on error (see errno).
+ */
+
+int ifcache_index(struct ifcache *c, int ifindex);
+/*
+ * Returns the cache entry index for 'ifindex'. The interface name is
+ * available in c->entry[idx].name until the next ifcache_index() or
+ * ifcache_update() call. The index is stable for an interface as long
+ * as the cache does not need to grow (e.g. for colors or binlog ifids).
+ */
+
+void ifcache_update(struct ifcache *c);
+/*
+ * Processes pending RTNETLINK link notifications without blocking:
+ * renamed interfaces get their new name and removed interfaces are
+ * evicted from the cache.
+ */
+
+void ifcache_close(struct ifcache *c);
+/*
+ * Closes the RTNETLINK socket and releases the cache entries.
+ */
+
 #endif
@@ -52,11 +52,58 @@
 #define COMMENTSZ 200
 #define BUFSZ (sizeof("(1345212884.318850)") + IFNAMSIZ + 4 + CL_CFSZ + COMMENTSZ) /* for one line in the logfile */
 
+static int binlog2long(void)
+{
+	char ascframe[CL_LONGCFSZ];
+	struct binlog bl;
+	struct binlog_entry e;
+	int ret;
+
+	if (binlog_open_read(&bl, stdin)) {
+		fprintf(stderr, "read: no supported binary log file\n");
+		return 1;
+	}
+
+	while ((ret = binlog_read(&bl, &e)) > 0) {
+
+		if (e.type == BINLOG_REC_DROP) {
+			printf("DROPCOUNT: dropped %u CAN frame%s on '%s' socket (total drops %u)\n",
+			       e.drops, (e.drops > 1)?"s":"", e.ifname, e.total_drops);
+			continue;
+		}
+
+		sprint_long_canframe(ascframe, &e.frame,
+				     (CANLIB_VIEW_INDENT_SFF | CANLIB_VIEW_ASCII),
+				     (e.mtu == CANFD_MTU)?CANFD_MAX_DLEN:CAN_MAX_DLEN);
+
+		printf("(%010lu.%09lu)  %s  %s\n", e.ts.tv_sec, e.ts.tv_nsec,
+		       e.ifname, ascframe);
+	}
+
+	binlog_close(&bl);
+
+	if (ret < 0) {
+		fprintf(stderr, "read: broken binary log file\n");
+		return 1;
+	}
+
+	return 0;
+}
+
 int main(void)
 {
 	char buf[BUFSZ], timestamp[BUFSZ], device[BUFSZ], ascframe[BUFSZ];
 	struct canfd_frame cf;
 	int mtu, maxdlen;
+	int c;
+
+	/* detect the compact binary log file format (see lib.h) */
+	c = getc(stdin);
+	if (c == EOF)
+		return 0;
+	ungetc(c, stdin);
+	if (c == BINLOG_MAGIC[0])
+		return binlog2long();
 
 	while (fgets(buf, BUFSZ-1, stdin)) {
 		if (sscanf(buf, "%s %s %s", timestamp, device, ascframe) != 3)
@@ -91,5 +91,6 @@
 /* clear screen */
 
 #define CLR_SCREEN  "\33[2J"
+#define CLR_LINE    "\33[2K"
 
 #endif /* TERMINAL_H */